@@ -40,11 +40,10 @@ _mpc_long_options () {
 	COMPREPLY=($(mpc help | grep -o -- "$cur"'[a-z-]*=\?' | sed 's/[^=]$/& /'))
 }
 
-# Complete command names
+# Complete command names; "mpc commands" omits the hidden ones
 _mpc_commands () {
 	local IFS=$'\n'
-	hold=$(mpc help 2>&1 | awk '/^ *mpc [a-z]+ /{print $2" "}');
-	COMPREPLY=($(compgen -W "$hold"$'\n'"status " "$cur"))
+	COMPREPLY=($(compgen -W "$(mpc commands)"$'\n'"status"$'\n'"mv" -S ' ' "$cur"))
 }
 
 # Complete the add command (files)
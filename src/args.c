@@ -4,6 +4,7 @@
 #include "args.h"
 #include "charset.h"
 #include "list.h"
+#include "mpc.h"
 #include "options.h"
 #include "strcasecmp.h"
 
@@ -17,19 +18,42 @@
 #include <sys/param.h>
 #endif
 
+/**
+ * Read one line with getline() and strip the newline.
+ *
+ * @return the length of the line, or -1 at the end of the file
+ */
+static ssize_t
+read_line(FILE *file, char **line_p, size_t *size_p)
+{
+	ssize_t length = getline(line_p, size_p, file);
+	if (length > 0 && (*line_p)[length - 1] == '\n')
+		(*line_p)[--length] = '\0';
+	return length;
+}
+
+/**
+ * Append all lines from stdin to the list.
+ */
+static void
+stdin_to_list(struct List *list)
+{
+	char *line = NULL;
+	size_t size = 0;
+
+	while (read_line(stdin, &line, &size) >= 0)
+		insertInListWithoutKey(list, strdup(line));
+
+	free(line);
+}
+
 int
 stdinToArgArray(char ***array)
 {
 	struct List list;
 	makeList(&list);
 
-	char buffer[4096];
-
-	while (fgets(buffer, sizeof(buffer), stdin)) {
-		char *sp;
-		if((sp = strchr(buffer,'\n'))) *sp = '\0';
-		insertInListWithoutKey(&list, strdup(buffer));
-	}
+	stdin_to_list(&list);
 
 	const unsigned size = list.numberOfNodes;
 	*array = malloc((sizeof(char *))*size);
@@ -53,15 +77,7 @@ stdinAndPreambleToArgArray(char ***array, char *preamble)
 	makeList(&list);
 
 	insertInListWithoutKey(&list, strdup(preamble));
-	/* todo : factorize next statements... */
-
-	char buffer[4096];
-
-	while (fgets(buffer, sizeof(buffer), stdin)) {
-		char *sp;
-		if((sp = strchr(buffer,'\n'))) *sp = '\0';
-		insertInListWithoutKey(&list, strdup(buffer));
-	}
+	stdin_to_list(&list);
 
 	const unsigned size = list.numberOfNodes;
 	*array = malloc((sizeof(char *))*size);
@@ -78,6 +94,80 @@ stdinAndPreambleToArgArray(char ***array, char *preamble)
 	return size;
 }
 
+bool
+is_stdin_argument(int argc, char **argv)
+{
+	return argc == 1 && strcmp(argv[0], STDIN_SYMBOL) == 0;
+}
+
+void
+line_reader_init(struct line_reader *r, FILE *file)
+{
+	r->file = file;
+	r->line = NULL;
+	r->line_size = 0;
+	r->line_number = 0;
+}
+
+void
+line_reader_deinit(struct line_reader *r)
+{
+	free(r->line);
+}
+
+void
+line_chunk_init(struct line_chunk *c)
+{
+	mpc_buffer_init(&c->buffer);
+	c->offsets = NULL;
+	c->lines = NULL;
+	c->n_lines = c->capacity = 0;
+	c->first_line = 0;
+}
+
+void
+line_chunk_deinit(struct line_chunk *c)
+{
+	mpc_buffer_deinit(&c->buffer);
+	free(c->offsets);
+	free(c->lines);
+}
+
+unsigned
+line_reader_read(struct line_reader *r, struct line_chunk *c)
+{
+	mpc_buffer_clear(&c->buffer);
+	c->n_lines = 0;
+	c->first_line = r->line_number + 1;
+
+	while (c->n_lines < LINE_CHUNK_LINES &&
+	       c->buffer.length < LINE_CHUNK_BYTES) {
+		const ssize_t length = read_line(r->file, &r->line,
+						 &r->line_size);
+		if (length < 0)
+			break;
+
+		++r->line_number;
+
+		if (c->n_lines == c->capacity) {
+			c->capacity = c->capacity > 0 ? c->capacity * 2 : 64;
+			c->offsets = realloc(c->offsets,
+					     c->capacity * sizeof(*c->offsets));
+			c->lines = realloc(c->lines,
+					   c->capacity * sizeof(*c->lines));
+		}
+
+		/* the buffer may be reallocated while the chunk is
+		   filled, so the pointers are calculated at the end */
+		c->offsets[c->n_lines++] = c->buffer.length;
+		mpc_buffer_append(&c->buffer, r->line, length + 1);
+	}
+
+	for (unsigned i = 0; i < c->n_lines; ++i)
+		c->lines[i] = c->buffer.data + c->offsets[i];
+
+	return c->n_lines;
+}
 
 void
 free_pipe_array(unsigned max, char ** array)
@@ -86,6 +176,65 @@ free_pipe_array(unsigned max, char ** array)
 		free(array[i]);
 }
 
+int
+split_command_line(char *line, char ***array)
+{
+	unsigned n = 0, max = 8;
+	char **argv = malloc(max * sizeof(*argv));
+
+	char *src = line;
+	while (true) {
+		while (isspace((unsigned char)*src))
+			++src;
+
+		if (*src == '\0' || *src == '#')
+			break;
+
+		if (n >= max) {
+			max *= 2;
+			argv = realloc(argv, max * sizeof(*argv));
+		}
+
+		/* unquote the argument in place; the result is never
+		   longer than the source */
+		char *dest = src;
+		argv[n++] = dest;
+
+		char quote = 0;
+		while (*src != '\0') {
+			if (quote == 0 && isspace((unsigned char)*src))
+				break;
+
+			if (quote == 0 && (*src == '\'' || *src == '"')) {
+				quote = *src++;
+			} else if (quote != 0 && *src == quote) {
+				quote = 0;
+				++src;
+			} else if (quote != '\'' && *src == '\\' &&
+				   src[1] != '\0') {
+				*dest++ = src[1];
+				src += 2;
+			} else
+				*dest++ = *src++;
+		}
+
+		if (quote != 0) {
+			free(argv);
+			return -1;
+		}
+
+		const bool end = *src == '\0';
+		*dest = '\0';
+		if (end)
+			break;
+
+		++src;
+	}
+
+	*array = argv;
+	return n;
+}
+
 bool
 contains_absolute_path(unsigned argc, char **argv)
 {
@@ -5,8 +5,10 @@
 #define MPC_ARGS_H
 
 #include "Compiler.h"
+#include "buffer.h"
 
 #include <stdbool.h>
+#include <stdio.h>
 
 struct int_value_change {
 	int value;
@@ -22,6 +24,100 @@ stdinAndPreambleToArgArray(char ***array, char *);
 void
 free_pipe_array(unsigned max, char **array);
 
+/**
+ * Shall the arguments be read from stdin?  For commands which read
+ * stdin by themselves (see check_args()), the argument list is just
+ * STDIN_SYMBOL then.
+ */
+gcc_pure
+bool
+is_stdin_argument(int argc, char **argv);
+
+enum {
+	/**
+	 * The maximum number of lines in a #line_chunk.
+	 */
+	LINE_CHUNK_LINES = 1024,
+
+	/**
+	 * A #line_chunk is complete when it has this many bytes; this
+	 * keeps command lists well below MPD's
+	 * "max_command_list_size".
+	 */
+	LINE_CHUNK_BYTES = 64 * 1024,
+};
+
+/**
+ * Reads a file line by line, one #line_chunk at a time.  Lines may
+ * have any length.
+ */
+struct line_reader {
+	FILE *file;
+
+	/** the getline() buffer */
+	char *line;
+	size_t line_size;
+
+	/** the number of lines read so far */
+	unsigned line_number;
+};
+
+/**
+ * A chunk of lines read by line_reader_read().  It is reused for the
+ * next chunk, so its memory does not grow with the size of the file.
+ */
+struct line_chunk {
+	/** the lines, each followed by a null byte */
+	struct mpc_buffer buffer;
+
+	/** the position of each line in #buffer */
+	size_t *offsets;
+
+	/** pointers to the lines, valid until the next read */
+	char **lines;
+
+	unsigned n_lines, capacity;
+
+	/** the (1-based) line number of lines[0] */
+	unsigned first_line;
+};
+
+void
+line_reader_init(struct line_reader *r, FILE *file);
+
+void
+line_reader_deinit(struct line_reader *r);
+
+void
+line_chunk_init(struct line_chunk *c);
+
+void
+line_chunk_deinit(struct line_chunk *c);
+
+/**
+ * Read the next chunk of lines, replacing the previous contents of
+ * the chunk.
+ *
+ * @return the number of lines, 0 at the end of the file
+ */
+unsigned
+line_reader_read(struct line_reader *r, struct line_chunk *c);
+
+/**
+ * Split a command line into arguments, in place.  Arguments are
+ * separated by whitespace; single quotes, double quotes and
+ * backslashes work like in a shell, and an unquoted '#' at the start
+ * of an argument begins a comment.
+ *
+ * @param line the line to be split; it is modified
+ * @param array receives a newly allocated array of pointers into
+ * #line, to be freed with free()
+ * @return the number of arguments, or -1 on a syntax error
+ * (unterminated quote)
+ */
+int
+split_command_line(char *line, char ***array);
+
 gcc_pure
 bool
 contains_absolute_path(unsigned argc, char **argv);
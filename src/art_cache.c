@@ -0,0 +1,325 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "art_cache.h"
+#include "fnv1a.h"
+#include "config.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
+/**
+ * The beginning of each cache file.
+ */
+struct art_cache_header {
+	char magic[8];
+	uint64_t db_update;
+};
+
+static const char art_cache_magic[8] = { 'm', 'p', 'c', 'a', 'r', 't', '1', '\n' };
+
+/**
+ * The cache directory, created if necessary.
+ *
+ * @return a newly allocated path, or NULL on error
+ */
+static char *
+art_cache_directory(void)
+{
+	const char *base = getenv("XDG_CACHE_HOME");
+	const char *suffix = "/mpc/art";
+	if (base == NULL || *base == 0) {
+		base = getenv("HOME");
+		suffix = "/.cache/mpc/art";
+		if (base == NULL || *base == 0)
+			return NULL;
+	}
+
+	const size_t size = strlen(base) + strlen(suffix) + 1;
+	char *path = malloc(size);
+	snprintf(path, size, "%s%s", base, suffix);
+
+	/* create each missing component, the parents first; only
+	   the result of the last one matters */
+	for (char *p = path + 1;; ++p) {
+		if (*p != '/' && *p != 0)
+			continue;
+
+		const char ch = *p;
+		*p = 0;
+		const int result = mkdir(path, 0700);
+		*p = ch;
+
+		if (ch == 0) {
+			if (result < 0 && errno != EEXIST) {
+				free(path);
+				return NULL;
+			}
+
+			return path;
+		}
+	}
+}
+
+bool
+art_cache_init(struct art_cache *c, const char *cmd, const char *uri_utf8)
+{
+	c->path = NULL;
+	c->fd = -1;
+	c->tmp_path = NULL;
+	c->tmp = NULL;
+
+	/* remote songs have no directory, and may change any time */
+	if (strstr(uri_utf8, "://") != NULL)
+		return false;
+
+	char *directory = art_cache_directory();
+	if (directory == NULL)
+		return false;
+
+	uint_least64_t hash = fnv1a_64_string(FNV1A_64_INIT, cmd);
+	hash = fnv1a_64_string(hash, "\n");
+
+	const char *slash = strrchr(uri_utf8, '/');
+	if (strcmp(cmd, "albumart") == 0 && slash != NULL) {
+		/* "albumart" looks for a cover file next to the
+		   song */
+		char *song_directory = strndup(uri_utf8, slash - uri_utf8);
+		hash = fnv1a_64_string(hash, song_directory);
+		free(song_directory);
+	} else if (strcmp(cmd, "albumart") != 0)
+		hash = fnv1a_64_string(hash, uri_utf8);
+
+	const size_t size = strlen(directory) + 64;
+	c->path = malloc(size);
+	snprintf(c->path, size, "%s/%016" PRIxLEAST64, directory, hash);
+
+	/* the leading dot keeps art_cache_trim() of other processes
+	   away from the file */
+	c->tmp_path = malloc(size);
+	snprintf(c->tmp_path, size, "%s/.%016" PRIxLEAST64 ".%ld.tmp",
+		 directory, hash, (long)getpid());
+
+	free(directory);
+	return true;
+}
+
+void
+art_cache_deinit(struct art_cache *c)
+{
+	if (c->fd >= 0)
+		close(c->fd);
+
+	if (c->tmp != NULL) {
+		fclose(c->tmp);
+		unlink(c->tmp_path);
+	}
+
+	free(c->path);
+	free(c->tmp_path);
+}
+
+bool
+art_cache_open(struct art_cache *c)
+{
+	c->fd = open(c->path, O_RDONLY);
+	return c->fd >= 0;
+}
+
+/**
+ * Copy a part of a file to stdout.
+ */
+static bool
+copy_to_stdout(int fd, off_t offset, off_t size)
+{
+	/* data written with stdio must come first */
+	if (fflush(stdout) != 0)
+		return false;
+
+#ifdef HAVE_SENDFILE
+	while (size > 0) {
+		const ssize_t nbytes = sendfile(STDOUT_FILENO, fd, &offset,
+						size);
+		if (nbytes < 0) {
+			if (errno == EINVAL || errno == ENOSYS)
+				/* not supported for this kind of
+				   stdout */
+				break;
+
+			return false;
+		}
+
+		if (nbytes == 0)
+			/* the file has been truncated */
+			return false;
+
+		size -= nbytes;
+	}
+#endif
+
+	char buffer[65536];
+	while (size > 0) {
+		const size_t n = size < (off_t)sizeof(buffer)
+			? (size_t)size : sizeof(buffer);
+		const ssize_t nbytes = pread(fd, buffer, n, offset);
+		if (nbytes <= 0 ||
+		    fwrite(buffer, 1, nbytes, stdout) != (size_t)nbytes)
+			return false;
+
+		offset += nbytes;
+		size -= nbytes;
+	}
+
+	return true;
+}
+
+int
+art_cache_serve(struct art_cache *c, unsigned long db_update)
+{
+	struct art_cache_header header;
+	struct stat st;
+	if (c->fd < 0 || db_update == 0 ||
+	    pread(c->fd, &header, sizeof(header), 0) != sizeof(header) ||
+	    memcmp(header.magic, art_cache_magic, sizeof(header.magic)) != 0 ||
+	    header.db_update != db_update ||
+	    fstat(c->fd, &st) < 0)
+		return 0;
+
+	if (!copy_to_stdout(c->fd, sizeof(header),
+			    st.st_size - (off_t)sizeof(header))) {
+		/* nothing can be done about a partial copy */
+		fprintf(stderr, "Write error\n");
+		return -1;
+	}
+
+	/* the modification time orders the files for
+	   art_cache_trim() */
+	futimens(c->fd, NULL);
+	return 1;
+}
+
+void
+art_cache_begin(struct art_cache *c, unsigned long db_update)
+{
+	/* without a database, there is nothing which tells when the
+	   file gets stale */
+	if (db_update == 0)
+		return;
+
+	c->tmp = fopen(c->tmp_path, "wb");
+	if (c->tmp == NULL)
+		return;
+
+	struct art_cache_header header = {
+		.db_update = db_update,
+	};
+	memcpy(header.magic, art_cache_magic, sizeof(header.magic));
+	art_cache_write(c, &header, sizeof(header));
+}
+
+void
+art_cache_write(struct art_cache *c, const void *data, size_t size)
+{
+	if (c->tmp != NULL && fwrite(data, 1, size, c->tmp) != size) {
+		fclose(c->tmp);
+		c->tmp = NULL;
+		unlink(c->tmp_path);
+	}
+}
+
+struct art_cache_file {
+	char *name;
+	time_t mtime;
+	off_t size;
+};
+
+static int
+art_cache_file_compare(const void *a_, const void *b_)
+{
+	const struct art_cache_file *a = a_, *b = b_;
+	return (a->mtime > b->mtime) - (a->mtime < b->mtime);
+}
+
+/**
+ * Delete the least recently used files until the cache is not larger
+ * than #ART_CACHE_SIZE.
+ */
+static void
+art_cache_trim(const char *directory)
+{
+	DIR *dir = opendir(directory);
+	if (dir == NULL)
+		return;
+
+	const int dir_fd = dirfd(dir);
+
+	struct art_cache_file *files = NULL;
+	unsigned n_files = 0, capacity = 0;
+	uint_least64_t total = 0;
+
+	const struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		/* this skips "." and "..", and the temporary files
+		   of art_cache_begin() */
+		struct stat st;
+		if (entry->d_name[0] == '.' ||
+		    fstatat(dir_fd, entry->d_name, &st, 0) < 0 ||
+		    !S_ISREG(st.st_mode))
+			continue;
+
+		if (n_files == capacity) {
+			capacity = capacity > 0 ? capacity * 2 : 64;
+			files = realloc(files, capacity * sizeof(*files));
+		}
+
+		files[n_files++] = (struct art_cache_file){
+			.name = strdup(entry->d_name),
+			.mtime = st.st_mtime,
+			.size = st.st_size,
+		};
+		total += st.st_size;
+	}
+
+	qsort(files, n_files, sizeof(*files), art_cache_file_compare);
+
+	const uint_least64_t limit = (uint_least64_t)ART_CACHE_SIZE << 20;
+	for (unsigned i = 0; i < n_files && total > limit; ++i)
+		if (unlinkat(dir_fd, files[i].name, 0) == 0)
+			total -= files[i].size;
+
+	for (unsigned i = 0; i < n_files; ++i)
+		free(files[i].name);
+	free(files);
+	closedir(dir);
+}
+
+void
+art_cache_commit(struct art_cache *c)
+{
+	if (c->tmp == NULL)
+		return;
+
+	FILE *tmp = c->tmp;
+	c->tmp = NULL;
+
+	if (fclose(tmp) != 0 || rename(c->tmp_path, c->path) != 0) {
+		unlink(c->tmp_path);
+		return;
+	}
+
+	char *slash = strrchr(c->path, '/');
+	*slash = 0;
+	art_cache_trim(c->path);
+	*slash = '/';
+}
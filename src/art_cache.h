@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef MPC_ART_CACHE_H
+#define MPC_ART_CACHE_H
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * A file in the album art cache (see option "--art-cache").  Each
+ * file starts with the database update time of MPD at the time it
+ * was downloaded; it is stale when the database has been updated
+ * since.  The least recently used files are deleted when the cache
+ * exceeds #ART_CACHE_SIZE.
+ */
+struct art_cache {
+	char *path;
+
+	/** the cache file opened by art_cache_open() */
+	int fd;
+
+	/** the new file being written by art_cache_begin() */
+	char *tmp_path;
+	FILE *tmp;
+};
+
+#ifdef ENABLE_ART_CACHE
+
+/**
+ * Locate the cache file for a picture.  Album art is shared by all
+ * songs in a directory; embedded pictures are cached per song.
+ *
+ * @param cmd "albumart" or "readpicture"
+ * @return false if the picture cannot be cached (e.g. a remote URI,
+ * or no cache directory)
+ */
+bool
+art_cache_init(struct art_cache *c, const char *cmd, const char *uri_utf8);
+
+/**
+ * Free resources, and delete the new file if art_cache_commit() has
+ * not been called.
+ */
+void
+art_cache_deinit(struct art_cache *c);
+
+/**
+ * Open the cache file, if it exists.  It may be stale.
+ */
+bool
+art_cache_open(struct art_cache *c);
+
+/**
+ * Copy the file opened by art_cache_open() to stdout if it is up to
+ * date, and mark it as recently used.
+ *
+ * @return 1 if the picture has been written, 0 if the file is stale,
+ * or -1 if writing has failed (after printing a message)
+ */
+int
+art_cache_serve(struct art_cache *c, unsigned long db_update);
+
+/**
+ * Start writing a new cache file.  Errors are ignored; the picture is
+ * not cached then.
+ */
+void
+art_cache_begin(struct art_cache *c, unsigned long db_update);
+
+void
+art_cache_write(struct art_cache *c, const void *data, size_t size);
+
+/**
+ * The new file is complete: replace the old one, and delete the least
+ * recently used files if the cache is too large.
+ */
+void
+art_cache_commit(struct art_cache *c);
+
+#else
+
+static inline bool
+art_cache_init(struct art_cache *c, const char *cmd, const char *uri_utf8)
+{
+	(void)c;
+	(void)cmd;
+	(void)uri_utf8;
+	return false;
+}
+
+static inline void
+art_cache_deinit(struct art_cache *c)
+{
+	(void)c;
+}
+
+static inline bool
+art_cache_open(struct art_cache *c)
+{
+	(void)c;
+	return false;
+}
+
+static inline int
+art_cache_serve(struct art_cache *c, unsigned long db_update)
+{
+	(void)c;
+	(void)db_update;
+	return 0;
+}
+
+static inline void
+art_cache_begin(struct art_cache *c, unsigned long db_update)
+{
+	(void)c;
+	(void)db_update;
+}
+
+static inline void
+art_cache_write(struct art_cache *c, const void *data, size_t size)
+{
+	(void)c;
+	(void)data;
+	(void)size;
+}
+
+static inline void
+art_cache_commit(struct art_cache *c)
+{
+	(void)c;
+}
+
+#endif
+
+#endif
@@ -2,15 +2,50 @@
 // Copyright The Music Player Daemon Project
 
 #include "binary.h"
+#include "args.h"
+#include "art_cache.h"
 #include "charset.h"
+#include "fnv1a.h"
+#include "options.h"
 #include "util.h"
+#include "writer.h"
 #include "Compiler.h"
 
 #include <mpd/client.h>
 
+#include <errno.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum {
+	/**
+	 * The chunk size requested with "binarylimit".  The server's
+	 * default is only 8 kB, which would take hundreds of chunks
+	 * for a large cover.
+	 */
+	BINARY_LIMIT = 1024 * 1024,
+
+	/**
+	 * The maximum number of chunks requested in one command list.
+	 * MPD buffers the responses of a command list, and
+	 * disconnects clients whose output buffer exceeds
+	 * "max_output_buffer_size" (8 MB by default).
+	 */
+	BINARY_WINDOW = 4,
+};
+
+/**
+ * A buffer for one chunk.  It is allocated for the first chunk, and
+ * reused for all others (which are not larger).
+ */
+struct binary_buffer {
+	char *data;
+	size_t size;
+};
 
 static bool
 send_binary(struct mpd_connection *connection, const char *cmd,
@@ -24,75 +59,839 @@ send_binary(struct mpd_connection *connection, const char *cmd,
 				offset_buffer, NULL);
 }
 
+/**
+ * Send "binarylimit", if the server supports it.
+ */
+static bool
+send_binary_limit(struct mpd_connection *connection)
+{
+	char limit_buffer[32];
+	snprintf(limit_buffer, sizeof(limit_buffer), "%u",
+		 (unsigned)BINARY_LIMIT);
+
+	return mpd_send_command(connection, "binarylimit", limit_buffer,
+				NULL);
+}
+
+/**
+ * Receive one chunk (the response of one command in a "discrete"
+ * command list) into the buffer.
+ *
+ * @param total_r if not NULL, receives the "size" attribute (the
+ * total size of the file)
+ * @return the size of the chunk, or -1 on error; in that case, the
+ * connection is in an error state, or the response contains no
+ * binary data
+ */
+static long
+recv_chunk(struct mpd_connection *connection, struct binary_buffer *buffer,
+	   uint_least32_t *total_r)
+{
+	uint_least32_t size = 0;
+	bool found = false;
+
+	struct mpd_pair *pair;
+	while ((pair = mpd_recv_pair(connection)) != NULL) {
+		char *endptr;
+		const unsigned long value = strtoul(pair->value, &endptr, 10);
+		const bool valid = endptr != pair->value && *endptr == 0;
+
+		if (strcmp(pair->name, "size") == 0 && valid &&
+		    total_r != NULL)
+			*total_r = value;
+
+		if (strcmp(pair->name, "binary") == 0) {
+			mpd_return_pair(connection, pair);
+			if (!valid)
+				break;
+
+			size = value;
+			found = true;
+			break;
+		}
+
+		mpd_return_pair(connection, pair);
+	}
+
+	if (!found)
+		return -1;
+
+	if (size > buffer->size) {
+		/* only for the first chunk, or if the server does not
+		   respect "binarylimit" */
+		free(buffer->data);
+		buffer->data = malloc(size);
+		buffer->size = size;
+	}
+
+	if (!mpd_recv_binary(connection, buffer->data, size))
+		return -1;
+
+	return size;
+}
+
+/**
+ * Write the whole buffer to a file descriptor.
+ */
+static bool
+write_full(int fd, const char *data, size_t size)
+{
+	while (size > 0) {
+		const ssize_t nbytes = write(fd, data, size);
+		if (nbytes < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		data += nbytes;
+		size -= nbytes;
+	}
+
+	return true;
+}
+
+/**
+ * Receive one chunk with recv_chunk() and write it to a file
+ * descriptor.  Errors other than server errors are fatal; this is for
+ * cmd_binary(), which handles one file only.
+ *
+ * The chunk is written with write() directly from the buffer it was
+ * received into; going through stdio would copy each chunk once more
+ * into the stdout buffer, which does not help with chunks of this
+ * size.
+ *
+ * @return the size of the chunk, or -1 on error (after printing a
+ * message)
+ */
+static long
+recv_chunk_to(struct mpd_connection *connection, struct binary_buffer *buffer,
+	      uint_least32_t *total_r, int fd)
+{
+	const long size = recv_chunk(connection, buffer, total_r);
+	if (size < 0) {
+		if (mpd_connection_get_error(connection) != MPD_ERROR_SUCCESS)
+			printErrorAndExit(connection);
+
+		fprintf(stderr, "No data\n");
+		return -1;
+	}
+
+	if (!write_full(fd, buffer->data, size)) {
+		fprintf(stderr, "Write error\n");
+		return -1;
+	}
+
+	return size;
+}
+
+/**
+ * Skip to the response of the next command in a "discrete" command
+ * list.
+ */
+static void
+next_response(struct mpd_connection *connection)
+{
+	if (!mpd_response_next(connection))
+		printErrorAndExit(connection);
+}
+
+/**
+ * Check whether a chunk had the expected size, i.e. whether the
+ * offsets of the chunks requested after it in the same command list
+ * are still right.  If the chunk is larger than expected (because the
+ * first one was short), the expected size is updated.
+ *
+ * @param offset the offset after the chunk
+ */
+static bool
+is_full_chunk(uint_least32_t size, uint_least32_t *chunk_size_p,
+	      uint_least32_t offset, uint_least32_t total)
+{
+	if (size > *chunk_size_p) {
+		*chunk_size_p = size;
+		return false;
+	}
+
+	return size == *chunk_size_p || offset >= total;
+}
+
+/**
+ * Receive the response of "stats" and return the time of the last
+ * database update.
+ */
+static unsigned long
+recv_db_update(struct mpd_connection *connection)
+{
+	struct mpd_stats *stats = mpd_recv_stats(connection);
+	if (stats == NULL)
+		printErrorAndExit(connection);
+
+	const unsigned long db_update = mpd_stats_get_db_update_time(stats);
+	mpd_stats_free(stats);
+	return db_update;
+}
+
+/**
+ * Download a picture and write it to stdout.
+ *
+ * @param cache if not NULL, the picture is served from this cache
+ * file if it is up to date, and stored in it otherwise
+ */
 static int
-cmd_binary(const char *cmd, const char *uri_utf8,
+cmd_binary(const char *cmd, const char *uri_utf8, struct art_cache *cache,
 	   struct mpd_connection *connection)
 {
-	char *buffer = NULL;
-	size_t buffer_size = 0;
+	unsigned long db_update = 0;
+	bool send_stats = false;
 
-	uint_least32_t offset = 0;
-	while (true) {
-		if (!send_binary(connection, cmd, uri_utf8, offset))
-			printErrorAndExit(connection);
+	if (cache != NULL) {
+		if (art_cache_open(cache)) {
+			/* the file may be stale */
+			if (!mpd_send_stats(connection))
+				printErrorAndExit(connection);
 
-		struct mpd_pair *pair = mpd_recv_pair_named(connection, "binary");
-		if (pair == NULL) {
+			db_update = recv_db_update(connection);
 			my_finishCommand(connection);
-			fprintf(stderr, "No data\n");
-			return 1;
+
+			const int result = art_cache_serve(cache, db_update);
+			if (result != 0)
+				return result > 0 ? 0 : -1;
+		} else
+			/* nothing cached yet; the database update
+			   time is requested along with the first
+			   chunk */
+			send_stats = true;
+	}
+
+	struct binary_buffer buffer = { NULL, 0 };
+
+	/* the chunks bypass stdio (see recv_chunk_to()), so anything
+	   written before (e.g. by a previous command in a chain) must
+	   come first */
+	writer_flush();
+
+	/* the first chunk tells the total size and the server's chunk
+	   size; "binarylimit" is sent in the same round trip */
+	const bool binary_limit =
+		mpd_connection_cmp_server_version(connection, 0, 22, 4) >= 0;
+
+	if (!mpd_command_list_begin(connection, true) ||
+	    (send_stats && !mpd_send_stats(connection)) ||
+	    (binary_limit && !send_binary_limit(connection)) ||
+	    !send_binary(connection, cmd, uri_utf8, 0) ||
+	    !mpd_command_list_end(connection))
+		printErrorAndExit(connection);
+
+	if (send_stats) {
+		db_update = recv_db_update(connection);
+		next_response(connection);
+	}
+
+	if (binary_limit)
+		next_response(connection);
+
+	uint_least32_t total = 0;
+	long size = recv_chunk_to(connection, &buffer, &total,
+				  STDOUT_FILENO);
+	if (size < 0) {
+		mpd_response_finish(connection);
+		free(buffer.data);
+		return 1;
+	}
+
+	my_finishCommand(connection);
+
+	if (cache != NULL) {
+		art_cache_begin(cache, db_update);
+		art_cache_write(cache, buffer.data, size);
+	}
+
+	/* request the remaining chunks, several per command list, at
+	   offsets which assume that each chunk has the size of the
+	   first one; MPD reads only once per request, so a chunk
+	   may be shorter (e.g. on network storage), which is checked
+	   below */
+	uint_least32_t chunk_size = size;
+	uint_least32_t offset = size;
+	while (chunk_size > 0 && offset < total) {
+		if (!mpd_command_list_begin(connection, true))
+			printErrorAndExit(connection);
+
+		unsigned n = 0;
+		for (uint_least32_t o = offset;
+		     n < BINARY_WINDOW && o < total; o += chunk_size, ++n)
+			if (!send_binary(connection, cmd, uri_utf8, o))
+				printErrorAndExit(connection);
+
+		if (!mpd_command_list_end(connection))
+			printErrorAndExit(connection);
+
+		/* set after a chunk of unexpected size: the following
+		   chunks were requested at the wrong offsets, so they
+		   are received and discarded, and requested again from
+		   the real offset */
+		bool discard = false;
+
+		for (unsigned i = 0; i < n; ++i) {
+			if (i > 0)
+				next_response(connection);
+
+			if (discard) {
+				if (recv_chunk(connection, &buffer, NULL) < 0 &&
+				    mpd_connection_get_error(connection) != MPD_ERROR_SUCCESS)
+					printErrorAndExit(connection);
+				continue;
+			}
+
+			size = recv_chunk_to(connection, &buffer, NULL,
+					     STDOUT_FILENO);
+			if (size < 0) {
+				mpd_response_finish(connection);
+				free(buffer.data);
+				return 1;
+			}
+
+			if (size == 0) {
+				/* the file has been truncated */
+				total = offset;
+				discard = true;
+				continue;
+			}
+
+			if (cache != NULL)
+				art_cache_write(cache, buffer.data, size);
+
+			offset += size;
+
+			if (!is_full_chunk(size, &chunk_size, offset, total))
+				discard = true;
 		}
 
-		char *endptr;
-		uint_least32_t size = strtoul(pair->value, &endptr, 10);
-		mpd_return_pair(connection, pair);
-		if (endptr == pair->value || *endptr != 0) {
-			my_finishCommand(connection);
-			fprintf(stderr, "No data\n");
-			return 1;
+		my_finishCommand(connection);
+	}
+
+	free(buffer.data);
+
+	if (cache != NULL)
+		art_cache_commit(cache);
+
+	return 0;
+}
+
+enum {
+	/**
+	 * The maximum number of files being exported at the same
+	 * time by binary_export().  The freshness checks of all of
+	 * them may share one command list; chunks are still limited
+	 * to #BINARY_WINDOW per list.
+	 */
+	EXPORT_JOBS = 32,
+};
+
+enum export_state {
+	EXPORT_FREE,
+
+	/**
+	 * The file exists; the song's modification time is queried
+	 * with "lsinfo" to find out whether it is up to date.
+	 */
+	EXPORT_CHECK,
+
+	EXPORT_FETCH,
+};
+
+/**
+ * One file being exported by binary_export().
+ */
+struct export_job {
+	enum export_state state;
+
+	char *uri_utf8;
+
+	/** the file name in the output directory */
+	char *path;
+
+	/** the temporary file which is renamed to #path when complete */
+	char *tmp_path;
+	FILE *file;
+
+	/** the number of bytes received so far */
+	uint_least32_t offset;
+
+	/** the total size; only valid if #chunk_size is non-zero */
+	uint_least32_t total;
+
+	/** the server's chunk size; 0 until the first chunk arrives */
+	uint_least32_t chunk_size;
+};
+
+/**
+ * One command in a command list sent by binary_export().
+ */
+struct export_entry {
+	enum {
+		EXPORT_ENTRY_BINARY_LIMIT,
+
+		/** "lsinfo" for a job in the #EXPORT_CHECK state */
+		EXPORT_ENTRY_CHECK,
+
+		/** a chunk request for a job in the #EXPORT_FETCH state */
+		EXPORT_ENTRY_CHUNK,
+	} type;
+
+	struct export_job *job;
+
+	/** the offset of the requested chunk */
+	uint_least32_t offset;
+};
+
+/**
+ * Where binary_export() gets its URIs from: either one command line
+ * argument or a list on stdin.
+ */
+struct export_source {
+	const char *argument;
+
+	bool from_stdin;
+	struct line_reader reader;
+	struct line_chunk chunk;
+	unsigned next_line;
+};
+
+/**
+ * @return the next URI (in the locale charset), or NULL at the end
+ */
+static const char *
+export_source_next(struct export_source *source)
+{
+	if (!source->from_stdin) {
+		const char *uri = source->argument;
+		source->argument = NULL;
+		return uri;
+	}
+
+	while (true) {
+		if (source->next_line >= source->chunk.n_lines) {
+			if (line_reader_read(&source->reader,
+					     &source->chunk) == 0)
+				return NULL;
+
+			source->next_line = 0;
+		}
+
+		const char *uri = source->chunk.lines[source->next_line++];
+		if (*uri != 0)
+			return uri;
+	}
+}
+
+static char *
+format_path(const char *directory, uint_least64_t hash, const char *suffix)
+{
+	const size_t size = strlen(directory) + 32;
+	char *path = malloc(size);
+	snprintf(path, size, "%s/%016" PRIxLEAST64 "%s",
+		 directory, hash, suffix);
+	return path;
+}
+
+static void
+export_job_start(struct export_job *job, const char *directory,
+		 const char *uri)
+{
+	job->uri_utf8 = strdup(charset_to_utf8(uri));
+
+	const uint_least64_t hash =
+		fnv1a_64_string(FNV1A_64_INIT, job->uri_utf8);
+	job->path = format_path(directory, hash, "");
+	job->tmp_path = format_path(directory, hash, ".tmp");
+	job->file = NULL;
+	job->offset = 0;
+	job->total = 0;
+	job->chunk_size = 0;
+
+	/* an existing file may be up to date; a missing one is
+	   fetched right away */
+	job->state = access(job->path, F_OK) == 0
+		? EXPORT_CHECK
+		: EXPORT_FETCH;
+}
+
+static void
+export_job_free(struct export_job *job)
+{
+	if (job->file != NULL) {
+		fclose(job->file);
+		unlink(job->tmp_path);
+	}
+
+	free(job->uri_utf8);
+	free(job->path);
+	free(job->tmp_path);
+	job->state = EXPORT_FREE;
+}
+
+/**
+ * Print an error message about a job and free it.
+ */
+static void
+export_job_fail(struct export_job *job, const char *message)
+{
+	fprintf(stderr, "%s: %s\n", charset_from_utf8(job->uri_utf8),
+		message);
+	export_job_free(job);
+}
+
+/**
+ * The file has been received completely: move it to its final
+ * location.
+ *
+ * @return true on success
+ */
+static bool
+export_job_commit(struct export_job *job)
+{
+	FILE *file = job->file;
+	job->file = NULL;
+
+	if (file == NULL) {
+		/* empty file */
+		file = fopen(job->tmp_path, "wb");
+		if (file == NULL) {
+			export_job_fail(job, strerror(errno));
+			return false;
 		}
+	}
+
+	if (fclose(file) != 0 || rename(job->tmp_path, job->path) != 0) {
+		unlink(job->tmp_path);
+		export_job_fail(job, strerror(errno));
+		return false;
+	}
+
+	if (options.verbosity >= V_VERBOSE)
+		printf("%s\t%s\n", job->path,
+		       charset_from_utf8(job->uri_utf8));
+
+	export_job_free(job);
+	return true;
+}
+
+/**
+ * Receive the "lsinfo" response of a job in the #EXPORT_CHECK state,
+ * and decide whether the file needs to be fetched.
+ */
+static void
+export_job_recv_check(struct mpd_connection *connection,
+		      struct export_job *job, unsigned *n_skipped)
+{
+	struct mpd_song *song = mpd_recv_song(connection);
+	if (song == NULL) {
+		/* not a song; let "albumart" report the error */
+		job->state = EXPORT_FETCH;
+		return;
+	}
+
+	const time_t last_modified = mpd_song_get_last_modified(song);
+	mpd_song_free(song);
+
+	struct stat st;
+	if (last_modified > 0 && stat(job->path, &st) == 0 &&
+	    st.st_mtime >= last_modified) {
+		++*n_skipped;
+		export_job_free(job);
+	} else
+		job->state = EXPORT_FETCH;
+}
+
+/**
+ * Receive a chunk for a job in the #EXPORT_FETCH state and append it
+ * to the temporary file.  The chunk is discarded if the job has
+ * finished or failed meanwhile, or if it was requested at an offset
+ * which turned out to be wrong because a previous chunk of the same
+ * command list had an unexpected size.
+ *
+ * @param offset the offset at which the chunk was requested
+ * @return false if the connection has failed
+ */
+static bool
+export_job_recv_chunk(struct mpd_connection *connection,
+		      struct export_job *job, uint_least32_t offset,
+		      struct binary_buffer *buffer,
+		      unsigned *n_written, unsigned *n_failed)
+{
+	uint_least32_t total = job->total;
+	const long size = recv_chunk(connection, buffer, &total);
+	if (size < 0 &&
+	    mpd_connection_get_error(connection) != MPD_ERROR_SUCCESS)
+		return false;
+
+	if (job->state != EXPORT_FETCH || offset != job->offset)
+		return true;
+
+	if (size < 0) {
+		++*n_failed;
+		export_job_fail(job, "No data");
+		return true;
+	}
+
+	if (job->chunk_size == 0) {
+		job->total = total;
+		job->chunk_size = size;
+	} else
+		/* MPD reads only once per request, so the first chunk
+		   may have been short; the offsets of the following
+		   requests are based on the largest chunk seen */
+		is_full_chunk(size, &job->chunk_size, offset + size,
+			      job->total);
+
+	if (size > 0) {
+		if (job->file == NULL) {
+			job->file = fopen(job->tmp_path, "wb");
+			if (job->file == NULL) {
+				++*n_failed;
+				export_job_fail(job, strerror(errno));
+				return true;
+			}
+		}
+
+		if (fwrite(buffer->data, 1, size, job->file) != (size_t)size) {
+			++*n_failed;
+			export_job_fail(job, "Write error");
+			return true;
+		}
+
+		job->offset += size;
+	}
 
-		if (size == 0)
-			/* end of file */
+	/* an empty chunk means the file has been truncated */
+	if (size == 0 || job->offset >= job->total) {
+		if (export_job_commit(job))
+			++*n_written;
+		else
+			++*n_failed;
+	}
+
+	return true;
+}
+
+/**
+ * Fetch the pictures of all URIs from the source with the given
+ * command, and write each to a file named by a hash of the URI.
+ * Files which are newer than the song are skipped.
+ *
+ * Requests for different URIs share command lists, so a large number
+ * of small pictures takes only a few round trips.
+ */
+static int
+binary_export(const char *cmd, struct export_source *source,
+	      const char *directory, struct mpd_connection *connection)
+{
+	struct export_job jobs[EXPORT_JOBS];
+	for (unsigned i = 0; i < EXPORT_JOBS; ++i)
+		jobs[i].state = EXPORT_FREE;
+
+	/* the commands in the current list */
+	struct export_entry entries[EXPORT_JOBS + BINARY_WINDOW + 1];
+
+	struct binary_buffer buffer = { NULL, 0 };
+	bool binary_limit =
+		mpd_connection_cmp_server_version(connection, 0, 22, 4) >= 0;
+	bool source_eof = false;
+	unsigned n_written = 0, n_skipped = 0, n_failed = 0;
+
+	while (true) {
+		unsigned n_active = 0;
+		for (unsigned i = 0; i < EXPORT_JOBS; ++i) {
+			struct export_job *job = &jobs[i];
+			if (job->state == EXPORT_FREE && !source_eof) {
+				const char *uri = export_source_next(source);
+				if (uri != NULL)
+					export_job_start(job, directory, uri);
+				else
+					source_eof = true;
+			}
+
+			if (job->state != EXPORT_FREE)
+				++n_active;
+		}
+
+		if (n_active == 0)
 			break;
 
-		if (size > buffer_size) {
-			if (size > 1024U * 1024U) {
-				fprintf(stderr, "Too large\n");
-				return 1;
+		unsigned n_entries = 0, n_chunks = 0;
+
+		if (!mpd_command_list_begin(connection, true))
+			printErrorAndExit(connection);
+
+		if (binary_limit) {
+			if (!send_binary_limit(connection))
+				printErrorAndExit(connection);
+			entries[n_entries++] = (struct export_entry){
+				.type = EXPORT_ENTRY_BINARY_LIMIT,
+			};
+		}
+
+		for (unsigned i = 0; i < EXPORT_JOBS; ++i) {
+			struct export_job *job = &jobs[i];
+			if (job->state == EXPORT_CHECK) {
+				if (!mpd_send_list_meta(connection,
+							job->uri_utf8))
+					printErrorAndExit(connection);
+				entries[n_entries++] = (struct export_entry){
+					.type = EXPORT_ENTRY_CHECK,
+					.job = job,
+				};
+			} else if (job->state == EXPORT_FETCH) {
+				/* the first chunk tells the chunk size;
+				   after that, the offsets of the
+				   following chunks are known */
+				uint_least32_t o = job->offset;
+				do {
+					if (n_chunks >= BINARY_WINDOW)
+						break;
+
+					if (!send_binary(connection, cmd,
+							 job->uri_utf8, o))
+						printErrorAndExit(connection);
+					entries[n_entries++] = (struct export_entry){
+						.type = EXPORT_ENTRY_CHUNK,
+						.job = job,
+						.offset = o,
+					};
+					++n_chunks;
+					o += job->chunk_size;
+				} while (job->chunk_size > 0 && o < job->total);
+			}
+		}
+
+		if (!mpd_command_list_end(connection))
+			printErrorAndExit(connection);
+
+		bool success = true;
+		for (unsigned i = 0; i < n_entries; ++i) {
+			if (i > 0 && !mpd_response_next(connection)) {
+				success = false;
+				break;
 			}
 
-			free(buffer);
-			buffer = malloc(size);
-			buffer_size = size;
+			const struct export_entry *entry = &entries[i];
+			switch (entry->type) {
+			case EXPORT_ENTRY_BINARY_LIMIT:
+				binary_limit = false;
+				break;
+
+			case EXPORT_ENTRY_CHECK:
+				export_job_recv_check(connection, entry->job,
+						      &n_skipped);
+				break;
+
+			case EXPORT_ENTRY_CHUNK:
+				success = export_job_recv_chunk(connection,
+								entry->job,
+								entry->offset,
+								&buffer,
+								&n_written,
+								&n_failed);
+				break;
+			}
+
+			if (!success)
+				break;
+		}
+
+		if (success) {
+			my_finishCommand(connection);
+			continue;
 		}
 
-		if (!mpd_recv_binary(connection, buffer, size))
+		/* MPD has aborted the command list; the job of the
+		   failed command is given up, and the commands after it
+		   are sent again with the next list */
+		if (mpd_connection_get_error(connection) != MPD_ERROR_SERVER)
 			printErrorAndExit(connection);
 
-		my_finishCommand(connection);
+		const unsigned location =
+			mpd_connection_get_server_error_location(connection);
+		if (location >= n_entries ||
+		    entries[location].type == EXPORT_ENTRY_BINARY_LIMIT)
+			printErrorAndExit(connection);
 
-		size_t nbytes = fwrite(buffer, 1, size, stdout);
-		if (nbytes != size) {
-			fprintf(stderr, "Write error\n");
-			return 1;
+		struct export_job *job = entries[location].job;
+		if (job->state != EXPORT_FREE) {
+			++n_failed;
+			const char *message =
+				mpd_connection_get_error_message(connection);
+			export_job_fail(job, charset_from_utf8(message));
 		}
 
-		offset += size;
+		if (!mpd_connection_clear_error(connection))
+			printErrorAndExit(connection);
 	}
-	return 0;
+
+	free(buffer.data);
+
+	if (options.verbosity >= V_DEFAULT)
+		printf("%u written, %u up to date, %u failed\n",
+		       n_written, n_skipped, n_failed);
+
+	return n_failed > 0 ? -1 : 0;
+}
+
+static int
+cmd_binary_or_export(const char *cmd, int argc, char **argv,
+		     struct mpd_connection *connection)
+{
+	const bool from_stdin = is_stdin_argument(argc, argv);
+
+	if (options.output_dir == NULL) {
+		if (from_stdin)
+			DIE("Reading URIs from stdin requires --output-dir\n");
+
+		const char *uri_utf8 = charset_to_utf8(argv[0]);
+
+		struct art_cache cache;
+		if (options.art_cache &&
+		    art_cache_init(&cache, cmd, uri_utf8)) {
+			const int ret = cmd_binary(cmd, uri_utf8, &cache,
+						   connection);
+			art_cache_deinit(&cache);
+			return ret;
+		}
+
+		return cmd_binary(cmd, uri_utf8, NULL, connection);
+	}
+
+	struct export_source source = {
+		.argument = argv[0],
+		.from_stdin = from_stdin,
+	};
+
+	if (from_stdin) {
+		line_reader_init(&source.reader, stdin);
+		line_chunk_init(&source.chunk);
+	}
+
+	const int ret = binary_export(cmd, &source, options.output_dir,
+				      connection);
+
+	if (from_stdin) {
+		line_chunk_deinit(&source.chunk);
+		line_reader_deinit(&source.reader);
+	}
+
+	return ret;
 }
 
 int
-cmd_albumart(gcc_unused int argc, char **argv,
-	     struct mpd_connection *connection)
+cmd_albumart(int argc, char **argv, struct mpd_connection *connection)
 {
-	return cmd_binary("albumart", charset_to_utf8(argv[0]), connection);
+	return cmd_binary_or_export("albumart", argc, argv, connection);
 }
 
 int
-cmd_readpicture(gcc_unused int argc, char **argv,
-		struct mpd_connection *connection)
+cmd_readpicture(int argc, char **argv, struct mpd_connection *connection)
 {
-	return cmd_binary("readpicture", charset_to_utf8(argv[0]), connection);
+	return cmd_binary_or_export("readpicture", argc, argv, connection);
 }
@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void
+mpc_buffer_deinit(struct mpc_buffer *b)
+{
+	free(b->data);
+}
+
+char *
+mpc_buffer_reserve(struct mpc_buffer *b, size_t n)
+{
+	if (b->length + n >= b->capacity) {
+		size_t capacity = b->capacity > 0 ? b->capacity : 256;
+		while (b->length + n >= capacity)
+			capacity *= 2;
+
+		b->data = realloc(b->data, capacity);
+		b->capacity = capacity;
+	}
+
+	return b->data + b->length;
+}
+
+void
+mpc_buffer_append(struct mpc_buffer *b, const char *src, size_t n)
+{
+	memcpy(mpc_buffer_reserve(b, n), src, n);
+	mpc_buffer_commit(b, n);
+}
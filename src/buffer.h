@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef MPC_BUFFER_H
+#define MPC_BUFFER_H
+
+#include <assert.h>
+#include <stddef.h>
+
+/**
+ * A growable null-terminated string buffer with a tracked length.
+ * Clearing or truncating it keeps the allocation, so it can be
+ * reused without heap traffic.
+ */
+struct mpc_buffer {
+	char *data;
+	size_t length, capacity;
+};
+
+static inline void
+mpc_buffer_init(struct mpc_buffer *b)
+{
+	b->data = NULL;
+	b->length = 0;
+	b->capacity = 0;
+}
+
+void
+mpc_buffer_deinit(struct mpc_buffer *b);
+
+/**
+ * Ensure that at least the given number of bytes (plus the null
+ * terminator) can be appended without reallocating.
+ *
+ * @return a pointer to the end of the buffer, where the caller may
+ * write up to #n bytes before calling mpc_buffer_commit()
+ */
+char *
+mpc_buffer_reserve(struct mpc_buffer *b, size_t n);
+
+/**
+ * Mark the given number of bytes written after mpc_buffer_reserve()
+ * as part of the string.
+ */
+static inline void
+mpc_buffer_commit(struct mpc_buffer *b, size_t n)
+{
+	assert(b->length + n < b->capacity);
+
+	b->length += n;
+	b->data[b->length] = '\0';
+}
+
+void
+mpc_buffer_append(struct mpc_buffer *b, const char *src, size_t n);
+
+/**
+ * Discard everything after the given length.
+ */
+static inline void
+mpc_buffer_truncate(struct mpc_buffer *b, size_t length)
+{
+	assert(length <= b->length);
+
+	b->length = length;
+	if (b->data != NULL)
+		b->data[length] = '\0';
+}
+
+static inline void
+mpc_buffer_clear(struct mpc_buffer *b)
+{
+	mpc_buffer_truncate(b, 0);
+}
+
+#endif
@@ -2,29 +2,113 @@
 // Copyright The Music Player Daemon Project
 
 #include "charset.h"
+#include "buffer.h"
 
 #include <unistd.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <errno.h>
 #include <string.h>
+#include <strings.h>
 
 #include <locale.h>
 #include <langinfo.h>
 #include <iconv.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 static bool charset_enable_input;
 static bool charset_enable_output;
+
+/**
+ * Has charset_setup() been called since charset_init()?
+ */
+static bool charset_initialized;
+
 static char *locale_charset;
 
-static iconv_t char_conv_iconv;
-static char * char_conv_to;
-static char * char_conv_from;
+/**
+ * A persistent iconv descriptor for one conversion direction.  It is
+ * opened on first use and kept until charset_deinit(); between two
+ * strings, its shift state is reset with iconv(cd, NULL, ...).
+ */
+struct charset_converter {
+	iconv_t cd;
+
+	/**
+	 * How many times iconv_open() was called for this direction.
+	 */
+	unsigned open_count;
+
+	bool is_open;
+
+	/**
+	 * Set if iconv_open() has failed; it is not retried.
+	 */
+	bool failed;
+};
+
+static struct charset_converter input_converter;
+static struct charset_converter output_converter;
+
 static int ignore_invalid;
 
-#define BUFFER_SIZE	1024
+/**
+ * Does the string consist only of 7 bit ASCII characters?  Those are
+ * the same in UTF-8 and in every locale charset we support, so they
+ * need no conversion.
+ */
+gcc_pure
+static bool
+is_ascii(const char *s, size_t length)
+{
+	const unsigned char *p = (const unsigned char *)s;
+	const unsigned char *const end = p + length;
+
+#if defined(__AVX2__)
+	for (; end - p >= 32; p += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)p);
+		if (_mm256_movemask_epi8(v) != 0)
+			return false;
+	}
+#elif defined(__SSE2__)
+	for (; end - p >= 16; p += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		if (_mm_movemask_epi8(v) != 0)
+			return false;
+	}
+#else
+	for (; end - p >= (ptrdiff_t)sizeof(uint64_t); p += sizeof(uint64_t)) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		if (v & UINT64_C(0x8080808080808080))
+			return false;
+	}
+#endif
 
-static void
-charset_close(void);
+	for (; p < end; ++p)
+		if (*p & 0x80)
+			return false;
+
+	return true;
+}
+
+/**
+ * Is this the name of the UTF-8 charset, i.e. is a conversion between
+ * it and UTF-8 a no-op?
+ */
+gcc_pure
+static bool
+is_utf8_charset(const char *charset)
+{
+	return strcasecmp(charset, "UTF-8") == 0 ||
+		strcasecmp(charset, "UTF8") == 0;
+}
 
 /* code from iconv_prog.c (omitting invalid symbols): */
 static inline char * mpc_strchrnul(const char *s, int c)
@@ -61,37 +145,50 @@ static char * skip_invalid(const char *to)
 	return newp;
 }
 
-static int
-charset_set2(const char *to, const char *from)
+/**
+ * Make sure the converter is open.
+ *
+ * @return false if the descriptor could not be opened
+ */
+static bool
+charset_converter_open(struct charset_converter *c,
+		       const char *to, const char *from)
 {
-	if(char_conv_to && strcmp(to,char_conv_to)==0 &&
-			char_conv_from && strcmp(from,char_conv_from)==0)
-		return 0;
-
-	charset_close();
+	if (c->is_open)
+		return true;
 
-	if ((char_conv_iconv = iconv_open(to,from))==(iconv_t)(-1))
-		return -1;
-
-	char_conv_to = strdup(to);
-	char_conv_from = strdup(from);
-	return 0;
-}
+	if (c->failed)
+		return false;
 
-static int
-charset_set(const char *to, const char *from)
-{
 	char *allocated;
 	if (ignore_invalid)
 		to = allocated = skip_invalid(to);
 	else
 		allocated = NULL;
 
-	int ret = charset_set2(to, from);
+	c->cd = iconv_open(to, from);
+	++c->open_count;
 
 	free(allocated);
 
-	return ret;
+	if (c->cd == (iconv_t)-1) {
+		c->failed = true;
+		return false;
+	}
+
+	c->is_open = true;
+	return true;
+}
+
+static void
+charset_converter_close(struct charset_converter *c)
+{
+	if (c->is_open) {
+		iconv_close(c->cd);
+		c->is_open = false;
+	}
+
+	c->failed = false;
 }
 
 static inline size_t deconst_iconv(iconv_t cd,
@@ -108,115 +205,160 @@ static inline size_t deconst_iconv(iconv_t cd,
 	return iconv(cd, deconst.b, inbytesleft, outbuf, outbytesleft);
 }
 
-static char *
-charset_conv_strdup(const char *string)
+/**
+ * Convert a string with the given iconv descriptor and append the
+ * result to the buffer.
+ *
+ * @return a pointer to the converted string inside the buffer; NULL
+ * on error (the buffer is then left unmodified)
+ */
+static const char *
+charset_conv_buffer(iconv_t cd, struct mpc_buffer *dest,
+		    const char *src, size_t length)
 {
-	if(!char_conv_to) return NULL;
-
-	size_t inleft = strlen(string);
-	size_t retlen = 0;
-
-	char *ret = strdup("");
-
-	while(inleft) {
-		char buffer[BUFFER_SIZE];
-		char *bufferPtr = buffer;
-		size_t outleft = BUFFER_SIZE;
-		size_t err = deconst_iconv(char_conv_iconv,
-					   &string, &inleft, &bufferPtr,
-					   &outleft);
-		if (outleft == BUFFER_SIZE ||
-		    (err == (size_t)-1 && errno != E2BIG)) {
-			free(ret);
-			return NULL;
+	/* discard the shift state left over from the previous string */
+	iconv(cd, NULL, NULL, NULL, NULL);
+
+	const size_t start = dest->length;
+	size_t slack = 16;
+
+	while (length > 0) {
+		const size_t n = length + slack;
+		char *const out = mpc_buffer_reserve(dest, n);
+		char *p = out;
+		size_t outleft = n;
+		size_t err = deconst_iconv(cd, &src, &length, &p, &outleft);
+		mpc_buffer_commit(dest, p - out);
+
+		if (err == (size_t)-1) {
+			if (errno != E2BIG) {
+				mpc_buffer_truncate(dest, start);
+				return NULL;
+			}
+
+			if (p == out)
+				/* not even one character fits */
+				slack *= 2;
 		}
-
-		ret = realloc(ret,retlen+BUFFER_SIZE-outleft+1);
-		memcpy(ret+retlen,buffer,BUFFER_SIZE-outleft);
-		retlen+=BUFFER_SIZE-outleft;
-		ret[retlen] = '\0';
 	}
 
-	return ret;
-}
-
-static void
-charset_close(void)
-{
-	if(char_conv_to) {
-		iconv_close(char_conv_iconv);
-		free(char_conv_to);
-		free(char_conv_from);
-		char_conv_to = NULL;
-		char_conv_from = NULL;
-	}
+	return dest->data + start;
 }
 
 void
 charset_init(bool enable_input, bool enable_output)
 {
-	if (!enable_input && !enable_output)
+	/* the locale is only inspected when the first string which
+	   is not pure ASCII needs to be converted (see
+	   charset_setup()); most invocations never get there */
+	charset_enable_input = enable_input;
+	charset_enable_output = enable_output;
+}
+
+/**
+ * Determine the locale charset.  Called on the first conversion of a
+ * string which is not pure ASCII.  Disables conversion if the locale
+ * is UTF-8 or unknown.
+ */
+static void
+charset_setup(void)
+{
+	if (charset_initialized)
 		return;
 
+	charset_initialized = true;
+
 	ignore_invalid = isatty(STDOUT_FILENO) && isatty(STDIN_FILENO);
 
 	const char *original_locale = setlocale(LC_CTYPE,"");
-	if (original_locale == NULL)
-		return;
-
-	const char *charset = nl_langinfo(CODESET);
-	if (charset != NULL)
-		locale_charset = strdup(charset);
+	if (original_locale != NULL) {
+		const char *charset = nl_langinfo(CODESET);
+		if (charset != NULL)
+			locale_charset = strdup(charset);
 
-	setlocale(LC_CTYPE,original_locale);
-
-	if (locale_charset != NULL) {
-		charset_enable_input = enable_input;
-		charset_enable_output = enable_output;
+		setlocale(LC_CTYPE,original_locale);
 	}
+
+	if (locale_charset == NULL || is_utf8_charset(locale_charset))
+		/* no locale or the locale is UTF-8 already: nothing
+		   to convert */
+		charset_enable_input = charset_enable_output = false;
 }
 
 void charset_deinit(void)
 {
-	charset_close();
+	charset_converter_close(&input_converter);
+	charset_converter_close(&output_converter);
 
 	free(locale_charset);
+	locale_charset = NULL;
+
+	charset_enable_input = charset_enable_output = false;
+	charset_initialized = false;
 }
 
 const char *
-charset_to_utf8(const char *from) {
-	static char * to = NULL;
+charset_to_utf8_buffer(struct mpc_buffer *dest,
+		       const char *src, size_t length)
+{
+	if (!charset_enable_input || is_ascii(src, length))
+		/* no locale or nothing to convert: return raw input */
+		return src;
 
+	charset_setup();
 	if (!charset_enable_input)
-		/* no locale: return raw input */
-		return from;
-
-	free(to);
-
-	charset_set("UTF-8", locale_charset);
-	to = charset_conv_strdup(from);
+		return src;
 
-	if (to == NULL)
-		return from;
+	if (!charset_converter_open(&input_converter,
+				    "UTF-8", locale_charset))
+		return src;
 
-	return to;
+	const char *result = charset_conv_buffer(input_converter.cd, dest,
+						 src, length);
+	return result != NULL ? result : src;
 }
 
 const char *
-charset_from_utf8(const char *from) {
-	static char * to = NULL;
+charset_from_utf8_buffer(struct mpc_buffer *dest,
+			 const char *src, size_t length)
+{
+	if (!charset_enable_output || is_ascii(src, length))
+		/* no locale or nothing to convert: return raw UTF-8 */
+		return src;
 
+	charset_setup();
 	if (!charset_enable_output)
-		/* no locale: return raw UTF-8 */
-		return from;
+		return src;
+
+	if (!charset_converter_open(&output_converter,
+				    locale_charset, "UTF-8"))
+		return src;
+
+	const char *result = charset_conv_buffer(output_converter.cd, dest,
+						 src, length);
+	return result != NULL ? result : src;
+}
 
-	free(to);
+const char *
+charset_to_utf8(const char *from)
+{
+	static struct mpc_buffer buffer;
+
+	mpc_buffer_clear(&buffer);
+	return charset_to_utf8_buffer(&buffer, from, strlen(from));
+}
 
-	charset_set(locale_charset, "UTF-8");
-	to = charset_conv_strdup(from);
+const char *
+charset_from_utf8(const char *from)
+{
+	static struct mpc_buffer buffer;
 
-	if (to == NULL)
-		return from;
+	mpc_buffer_clear(&buffer);
+	return charset_from_utf8_buffer(&buffer, from, strlen(from));
+}
 
-	return to;
+unsigned
+charset_open_count(void)
+{
+	return input_converter.open_count + output_converter.open_count;
 }
@@ -8,11 +8,16 @@
 #include "Compiler.h"
 
 #include <stdbool.h>
+#include <stddef.h>
+
+struct mpc_buffer;
 
 #ifdef HAVE_ICONV
 
 /**
- * Initializes the character set conversion library.
+ * Initializes the character set conversion library.  This is cheap:
+ * the locale is inspected only when the first string which is not
+ * pure ASCII gets converted.
  *
  * @param enable_input allow conversion from locale to UTF-8
  * @param enable_output allow conversion from UTF-8 to locale
@@ -22,16 +27,72 @@ charset_init(bool enable_input, bool enable_output);
 
 void charset_deinit(void);
 
-gcc_pure
+/**
+ * Convert a string from the locale charset to UTF-8, appending the
+ * result to a caller-owned buffer.  Several results may be kept in
+ * the same buffer or in different buffers at the same time.
+ *
+ * @param src the null-terminated string to be converted
+ * @param length the length of #src in bytes, i.e. strlen(src)
+ * @return #src itself if no conversion was necessary or possible;
+ * otherwise a pointer into #dest which is valid until #dest is
+ * modified again
+ */
+const char *
+charset_to_utf8_buffer(struct mpc_buffer *dest,
+		       const char *src, size_t length);
+
+/**
+ * Like charset_to_utf8_buffer(), but convert from UTF-8 to the
+ * locale charset.
+ */
+const char *
+charset_from_utf8_buffer(struct mpc_buffer *dest,
+			 const char *src, size_t length);
+
+/**
+ * Convert a string from the locale charset to UTF-8.  The returned
+ * pointer is valid until the next call.
+ */
 const char *
 charset_to_utf8(const char *from);
 
-gcc_pure
+/**
+ * Convert a string from UTF-8 to the locale charset.  The returned
+ * pointer is valid until the next call.
+ */
 const char *
 charset_from_utf8(const char *from);
 
+/**
+ * Returns the number of iconv_open() calls so far.  Each conversion
+ * direction is opened at most once per process, so this never
+ * exceeds 2.
+ */
+gcc_pure
+unsigned
+charset_open_count(void);
+
 #else
 
+static inline const char *
+charset_to_utf8_buffer(struct mpc_buffer *dest,
+		       const char *src, size_t length)
+{
+	(void)dest;
+	(void)length;
+	return src;
+}
+
+static inline const char *
+charset_from_utf8_buffer(struct mpc_buffer *dest,
+			 const char *src, size_t length)
+{
+	(void)dest;
+	(void)length;
+	return src;
+}
+
 static inline void
 charset_init(bool disable_input, bool disable_output)
 {
@@ -56,6 +117,12 @@ charset_from_utf8(const char *from)
 	return from;
 }
 
+static inline unsigned
+charset_open_count(void)
+{
+	return 0;
+}
+
 #endif
 
 #endif
@@ -13,6 +13,7 @@
 #include "tags.h"
 #include "path.h"
 #include "group.h"
+#include "buffer.h"
 #include "Compiler.h"
 
 #include <mpd/client.h>
@@ -23,13 +24,13 @@
 #include <stdlib.h>
 #include <limits.h>
 
-SIMPLE_CMD(cmd_next, mpd_run_next, 1)
-SIMPLE_CMD(cmd_prev, mpd_run_previous, 1)
-SIMPLE_CMD(cmd_stop, mpd_run_stop, 1)
-SIMPLE_CMD(cmd_clearerror, mpd_run_clearerror, 1)
+SIMPLE_CMD(cmd_next, mpd_send_next, 1)
+SIMPLE_CMD(cmd_prev, mpd_send_previous, 1)
+SIMPLE_CMD(cmd_stop, mpd_send_stop, 1)
+SIMPLE_CMD(cmd_clearerror, mpd_send_clearerror, 1)
 
-SIMPLE_ONEARG_CMD(cmd_save, mpd_run_save, 0)
-SIMPLE_ONEARG_CMD(cmd_rm, mpd_run_rm, 0)
+SIMPLE_ONEARG_CMD(cmd_save, mpd_send_save, 0)
+SIMPLE_ONEARG_CMD(cmd_rm, mpd_send_rm, 0)
 
 /**
  * Returns the id of the current song, but only if it is really
@@ -171,13 +172,17 @@ cmd_play(int argc, char **argv, struct mpd_connection *conn)
 
 		song--;
 
-		success = mpd_run_play_pos(conn, song);
-	} else
-		success = mpd_run_play(conn);
+		deferred_begin(conn);
+		success = mpd_send_play_pos(conn, song);
+	} else {
+		deferred_begin(conn);
+		success = mpd_send_play(conn);
+	}
 
 	if (!success)
 		printErrorAndExit(conn);
 
+	deferred_end(conn);
 	return 1;
 }
 
@@ -843,26 +848,37 @@ cmd_clearplaylist(int argc, char **argv, struct mpd_connection *conn)
 	return 0;
 }
 
+/**
+ * Send "load" for one playlist, with the range specified by
+ * "--range".
+ */
+static bool
+send_load(struct mpd_connection *conn, char *name)
+{
+	printf("loading: %s\n", name);
+
+	const char *name_utf8 = charset_to_utf8(name);
+	if (!range_is_full(&options.range))
+		return mpd_send_load_range(conn, name_utf8,
+					   options.range.start,
+					   options.range.end);
+	else
+		return mpd_send_load(conn, name_utf8);
+}
+
 int
 cmd_load(int argc, char **argv, struct mpd_connection *conn)
 {
-	const bool range = options.range.start > 0 ||
-		options.range.end < UINT_MAX;
+	if (is_stdin_argument(argc, argv)) {
+		send_stdin_lines(conn, "loading", NULL, send_load);
+		return 0;
+	}
 
 	if (!mpd_command_list_begin(conn, false))
 		printErrorAndExit(conn);
 
-	for (int i = 0; i < argc; ++i) {
-		printf("loading: %s\n",argv[i]);
-
-		const char *name_utf8 = charset_to_utf8(argv[i]);
-		if (range)
-			mpd_send_load_range(conn, name_utf8,
-					    options.range.start,
-					    options.range.end);
-		else
-			mpd_send_load(conn, name_utf8);
-	}
+	for (int i = 0; i < argc; ++i)
+		send_load(conn, argv[i]);
 
 	mpd_command_list_end(conn);
 	my_finishCommand(conn);
@@ -884,6 +900,75 @@ cmd_tags(gcc_unused int argc, gcc_unused char **argv, gcc_unused struct mpd_conn
 	return 0;
 }
 
+gcc_pure
+static bool
+line_in_range(unsigned line)
+{
+	return line >= options.range.start && line < options.range.end;
+}
+
+/**
+ * Print one line of the grouped output of "list", indented by its
+ * group depth.
+ */
+static void
+print_list_line(struct mpc_buffer *buffer, size_t depth, const char *value)
+{
+	mpc_buffer_clear(buffer);
+	printf("%*s%s\n", (int)depth * 4, "",
+	       charset_from_utf8_buffer(buffer, value, strlen(value)));
+}
+
+/**
+ * Receive and print the response of a grouped "list".  "--range"
+ * selects value lines only; the headers of their groups are printed
+ * before the first selected value line in the group.
+ */
+static void
+print_grouped_list(struct mpd_connection *conn,
+		   const struct mpc_groups *groups)
+{
+	struct mpc_buffer buffer;
+	mpc_buffer_init(&buffer);
+
+	/* the current value of each group, and the first group whose
+	   header has not been printed since it changed */
+	char *values[MAX_GROUPS] = { NULL };
+	size_t pending = 0;
+
+	unsigned line = 0;
+
+	struct mpd_pair *pair;
+	while ((pair = mpd_recv_pair(conn)) != NULL) {
+		const enum mpd_tag_type t = mpd_tag_name_iparse(pair->name);
+		const int i = t != MPD_TAG_UNKNOWN
+			? mpc_groups_find(groups, t)
+			: -1;
+
+		if (i >= 0) {
+			free(values[i]);
+			values[i] = strdup(pair->value);
+			if ((size_t)i < pending)
+				pending = i;
+		} else if (t != MPD_TAG_UNKNOWN && line_in_range(line++)) {
+			for (; pending < groups->n_groups; ++pending)
+				if (values[pending] != NULL)
+					print_list_line(&buffer, pending,
+							values[pending]);
+
+			print_list_line(&buffer, groups->n_groups,
+					pair->value);
+		}
+
+		mpd_return_pair(conn, pair);
+	}
+
+	for (size_t i = 0; i < groups->n_groups; ++i)
+		free(values[i]);
+
+	mpc_buffer_deinit(&buffer);
+}
+
 int
 cmd_list(int argc, char **argv, struct mpd_connection *conn)
 {
@@ -930,27 +1015,23 @@ cmd_list(int argc, char **argv, struct mpd_connection *conn)
 	if (!mpd_search_commit(conn))
 		printErrorAndExit(conn);
 
-	if (groups.n_groups > 0) {
-		struct mpd_pair *pair;
-		while ((pair = mpd_recv_pair(conn)) != NULL) {
-			enum mpd_tag_type t = mpd_tag_name_iparse(pair->name);
-			//printf("|| %s\n", pair->name);
-			if (t != MPD_TAG_UNKNOWN) {
-				int i = mpc_groups_find(&groups, t);
-				if (i < 0)
-					i = groups.n_groups;
-				if (i >= 0)
-					printf("%*s%s\n", i * 4, "",
-					       charset_from_utf8(pair->value));
-			}
-			mpd_return_pair(conn, pair);
-		}
-	} else {
+	/* "list" has no window, so "--range" selects value lines
+	   here */
+	if (groups.n_groups > 0)
+		print_grouped_list(conn, &groups);
+	else {
+		struct mpc_buffer buffer;
+		mpc_buffer_init(&buffer);
+
+		unsigned line = 0;
 		struct mpd_pair *pair;
 		while ((pair = mpd_recv_pair_tag(conn, type)) != NULL) {
-			printf("%s\n", charset_from_utf8(pair->value));
+			if (line_in_range(line++))
+				print_utf8_line(&buffer, pair->value);
 			mpd_return_pair(conn, pair);
 		}
+
+		mpc_buffer_deinit(&buffer);
 	}
 
 	my_finishCommand(conn);
@@ -993,8 +1074,10 @@ cmd_volume(int argc, char **argv, struct mpd_connection *conn)
 			return 1;
 	}
 
-	if (!mpd_run_set_volume(conn, ch.value))
+	deferred_begin(conn);
+	if (!mpd_send_set_volume(conn, ch.value))
 		printErrorAndExit(conn);
+	deferred_end(conn);
 	return 1;
 }
 
@@ -1002,8 +1085,9 @@ int
 cmd_pause(gcc_unused int argc, gcc_unused char **argv,
 	  struct mpd_connection *conn)
 {
+	deferred_begin(conn);
 	mpd_send_pause(conn, true);
-	my_finishCommand(conn);
+	deferred_end(conn);
 
 	return 1;
 }
@@ -1029,7 +1113,7 @@ cmd_pause_if_playing(gcc_unused int argc, gcc_unused char **argv,
 static int
 bool_cmd(int argc, char **argv, struct mpd_connection *conn,
 	 bool (*get_mode)(const struct mpd_status *status),
-	 bool (*run_set_mode)(struct mpd_connection *conn, bool mode))
+	 bool (*send_set_mode)(struct mpd_connection *conn, bool mode))
 {
 	bool mode;
 
@@ -1046,8 +1130,10 @@ bool_cmd(int argc, char **argv, struct mpd_connection *conn,
 		mpd_status_free(status);
 	}
 
-	if (!run_set_mode(conn, mode))
+	deferred_begin(conn);
+	if (!send_set_mode(conn, mode))
 		printErrorAndExit(conn);
+	deferred_end(conn);
 
 	return 1;
 }
@@ -1056,14 +1142,14 @@ int
 cmd_repeat(int argc, char **argv, struct mpd_connection *conn)
 {
 	return bool_cmd(argc, argv, conn,
-			mpd_status_get_repeat, mpd_run_repeat);
+			mpd_status_get_repeat, mpd_send_repeat);
 }
 
 int
 cmd_random(int argc, char **argv, struct mpd_connection *conn)
 {
 	return bool_cmd(argc, argv, conn,
-			mpd_status_get_random, mpd_run_random);
+			mpd_status_get_random, mpd_send_random);
 }
 
 int
@@ -1098,8 +1184,11 @@ cmd_single(int argc, char **argv, struct mpd_connection *conn)
 
 	if (mode == MPD_SINGLE_UNKNOWN)
 		return -1;
-	else if (!mpd_run_single_state(conn, mode))
+
+	deferred_begin(conn);
+	if (!mpd_send_single_state(conn, mode))
 		printErrorAndExit(conn);
+	deferred_end(conn);
 
 	return 1;
 }
@@ -1137,13 +1226,16 @@ cmd_consume(int argc, char **argv, struct mpd_connection *conn)
 
 	if (mode == MPD_CONSUME_UNKNOWN)
 		return -1;
-	else if (!mpd_run_consume_state(conn, mode))
+
+	deferred_begin(conn);
+	if (!mpd_send_consume_state(conn, mode))
 		printErrorAndExit(conn);
+	deferred_end(conn);
 
 	return 1;
 #else
 	return bool_cmd(argc, argv, conn,
-			mpd_status_get_consume, mpd_run_consume);
+			mpd_status_get_consume, mpd_send_consume);
 #endif
 }
 
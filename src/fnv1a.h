@@ -0,0 +1,26 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef MPC_FNV1A_H
+#define MPC_FNV1A_H
+
+#include "Compiler.h"
+
+#include <stdint.h>
+
+#define FNV1A_64_INIT 14695981039346656037ULL
+
+/**
+ * Feed a null-terminated string into a 64 bit FNV-1a hash, which
+ * names files derived from song URIs.  Start with #FNV1A_64_INIT.
+ */
+gcc_pure
+static inline uint_least64_t
+fnv1a_64_string(uint_least64_t hash, const char *s)
+{
+	for (const unsigned char *p = (const unsigned char *)s; *p != 0; ++p)
+		hash = (hash ^ *p) * 1099511628211ULL;
+	return hash;
+}
+
+#endif
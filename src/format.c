@@ -2,120 +2,276 @@
 // Copyright The Music Player Daemon Project
 
 #include "format.h"
+#include "buffer.h"
 
+#include <assert.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
-/**
- * Reallocate the given string and append the source string.
- */
-gcc_malloc
-static char *
-string_append(char *dest, const char *src, size_t len)
+enum format_op_type {
+	/**
+	 * Append a run of literal text.
+	 */
+	FORMAT_OP_LITERAL,
+
+	/**
+	 * Append the value of a "%name%" attribute.
+	 */
+	FORMAT_OP_ATTRIBUTE,
+
+	/**
+	 * Evaluate a nested "[...]" group and append its result.
+	 */
+	FORMAT_OP_GROUP,
+
+	/**
+	 * Close the current group (either ']' or the end of the
+	 * format string).
+	 */
+	FORMAT_OP_END,
+
+	/**
+	 * The '|' operator.
+	 */
+	FORMAT_OP_OR,
+
+	/**
+	 * The '&' operator.
+	 */
+	FORMAT_OP_AND,
+};
+
+struct format_op {
+	enum format_op_type type;
+
+	/**
+	 * LITERAL: the text; ATTRIBUTE: the verbatim "%name%"
+	 * specifier, to be emitted if the getter returns NULL.  This
+	 * is a position in format_template.text.
+	 */
+	unsigned offset, length;
+
+	/**
+	 * ATTRIBUTE: the id returned by format_attributes.resolve().
+	 *
+	 * OR/AND: the index of the operation which ends the following
+	 * section (i.e. the next operator or the end of the group).
+	 *
+	 * END: non-zero if the group is discarded when none of its
+	 * attributes was found (']'); zero at the end of the format
+	 * string.
+	 */
+	unsigned arg;
+};
+
+struct format_template {
+	/**
+	 * A copy of the format string this template was compiled
+	 * from.
+	 */
+	char *source;
+
+	const struct format_attributes *attributes;
+
+	/**
+	 * Bit mask of the attribute ids (below 64) referenced by
+	 * #ops.
+	 */
+	uint64_t attribute_mask;
+
+	struct format_op *ops;
+	unsigned n_ops, max_ops;
+
+	/**
+	 * Unescaped literal text referenced by #ops.
+	 */
+	char *text;
+	size_t text_length, text_max;
+};
+
+static bool
+is_name_char(char ch)
 {
-	size_t destlen = dest != NULL
-		? strlen(dest)
-		: 0;
+	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+		(ch >= '0' && ch <= '9') || ch == '_';
+}
 
-	dest = realloc(dest, destlen + len + 1);
-	memcpy(dest + destlen, src, len);
-	dest[destlen + len] = '\0';
+static unsigned
+template_add_text(struct format_template *t, const char *src, size_t length)
+{
+	if (t->text_length + length > t->text_max) {
+		t->text_max = (t->text_length + length) * 2;
+		t->text = realloc(t->text, t->text_max);
+	}
 
-	return dest;
+	const unsigned offset = t->text_length;
+	memcpy(t->text + offset, src, length);
+	t->text_length += length;
+	return offset;
 }
 
-/**
- * Skip the format string until the current group is closed by either
- * '&', '|' or ']' (supports nesting).
- */
-gcc_pure
-static const char *
-skip_format(const char *p)
+static struct format_op *
+template_add_op(struct format_template *t, enum format_op_type type)
 {
-	unsigned stack = 0;
+	if (t->n_ops >= t->max_ops) {
+		t->max_ops = t->max_ops > 0 ? t->max_ops * 2 : 16;
+		t->ops = realloc(t->ops, t->max_ops * sizeof(*t->ops));
+	}
 
-	while (*p != '\0') {
-		if (*p == '[')
-			stack++;
-		else if (*p == '#' && p[1] != '\0')
-			/* skip escaped stuff */
-			++p;
-		else if (stack > 0) {
-			if (*p == ']')
-				--stack;
-		} else if (*p == '&' || *p == '|' || *p == ']')
-			break;
+	struct format_op *op = &t->ops[t->n_ops++];
+	op->type = type;
+	op->offset = 0;
+	op->length = 0;
+	op->arg = 0;
+	return op;
+}
 
-		++p;
+static void
+template_add_literal(struct format_template *t, const char *src, size_t length)
+{
+	if (length == 0)
+		return;
+
+	/* merge with the previous literal if it ends where the new
+	   text is going to be appended */
+	if (t->n_ops > 0) {
+		struct format_op *prev = &t->ops[t->n_ops - 1];
+		if (prev->type == FORMAT_OP_LITERAL &&
+		    prev->offset + prev->length == t->text_length) {
+			template_add_text(t, src, length);
+			prev->length += length;
+			return;
+		}
 	}
 
-	return p;
+	const unsigned offset = template_add_text(t, src, length);
+	struct format_op *op = template_add_op(t, FORMAT_OP_LITERAL);
+	op->offset = offset;
+	op->length = length;
 }
 
-static bool
-is_name_char(char ch)
+static void
+template_add_attribute(struct format_template *t,
+		       const char *specifier, size_t length)
 {
-	return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
-		(ch >= '0' && ch <= '9') || ch == '_';
+	assert(length >= 2);
+
+	char name[32];
+	assert(length - 2 < sizeof(name));
+	memcpy(name, specifier + 1, length - 2);
+	name[length - 2] = 0;
+
+	const int id = t->attributes->resolve(name);
+	if (id < 0) {
+		/* unknown variable: copy verbatim from format
+		   string */
+		template_add_literal(t, specifier, length);
+		return;
+	}
+
+	const unsigned offset = template_add_text(t, specifier, length);
+
+	struct format_op *op = template_add_op(t, FORMAT_OP_ATTRIBUTE);
+	op->offset = offset;
+	op->length = length;
+	op->arg = id;
+
+	if (id < 64)
+		t->attribute_mask |= (uint64_t)1 << (unsigned)id;
 }
 
-static char *
-format_object2(const char *format, const char **last, const void *object,
-	       const char *(*getter)(const void *object, const char *name))
+/**
+ * The operators ('|' and '&') of an open group whose jump target
+ * (the end of the following section) is not yet known.
+ */
+struct format_compile_group {
+	unsigned pending_op;
+	bool has_pending;
+};
+
+static void
+template_close_section(struct format_template *t,
+		       struct format_compile_group *g)
 {
-	char *ret = NULL;
-	const char *p;
-	bool found = false;
+	if (g->has_pending) {
+		t->ops[g->pending_op].arg = t->n_ops;
+		g->has_pending = false;
+	}
+}
+
+static void
+template_add_operator(struct format_template *t,
+		      struct format_compile_group *g,
+		      enum format_op_type type)
+{
+	template_close_section(t, g);
+	template_add_op(t, type);
+	g->pending_op = t->n_ops - 1;
+	g->has_pending = true;
+}
+
+static void
+template_add_end(struct format_template *t, struct format_compile_group *g,
+		 bool discard)
+{
+	template_close_section(t, g);
+	template_add_op(t, FORMAT_OP_END)->arg = discard;
+}
+
+struct format_template *
+format_compile(const char *format, const struct format_attributes *attributes)
+{
+	struct format_template *t = calloc(1, sizeof(*t));
+	t->source = strdup(format);
+	t->attributes = attributes;
 
+	/* one entry per open "[...]" group; the first one is the
+	   top-level group */
+	unsigned depth = 0, max_depth = 8;
+	struct format_compile_group *stack =
+		malloc(max_depth * sizeof(*stack));
+	stack[0].has_pending = false;
+
+	const char *p;
 	for (p = format; *p != '\0';) {
 		switch (p[0]) {
 		case '|':
+			template_add_operator(t, &stack[depth], FORMAT_OP_OR);
 			++p;
-			if (!found) {
-				/* nothing found yet: try the next
-				   section */
-				free(ret);
-				ret = NULL;
-			} else
-				/* already found a value: skip the
-				   next section */
-				p = skip_format(p);
 			break;
 
 		case '&':
+			template_add_operator(t, &stack[depth], FORMAT_OP_AND);
 			++p;
-			if (!found)
-				/* nothing found yet, so skip this
-				   section */
-				p = skip_format(p);
-			else
-				/* we found something yet, but it will
-				   only be used if the next section
-				   also found something, so reset the
-				   flag */
-				found = false;
 			break;
 
-		case '[': {
-			char *t = format_object2(p + 1, &p, object, getter);
-			if (t != NULL) {
-				ret = string_append(ret, t, strlen(t));
-				free(t);
-				found = true;
+		case '[':
+			if (depth + 1 >= max_depth) {
+				max_depth *= 2;
+				stack = realloc(stack,
+						max_depth * sizeof(*stack));
 			}
-		}
+
+			template_add_op(t, FORMAT_OP_GROUP);
+			stack[++depth].has_pending = false;
+			++p;
 			break;
 
 		case ']':
-			if (last != NULL)
-				*last = p + 1;
-			if (!found) {
-				free(ret);
-				ret = NULL;
+			template_add_end(t, &stack[depth], true);
+
+			if (depth == 0) {
+				/* a stray ']' terminates the whole
+				   format string */
+				free(stack);
+				return t;
 			}
-			return ret;
+
+			--depth;
+			++p;
+			break;
 
 		case '\\': {
 			/* take care of escape sequences */
@@ -166,7 +322,7 @@ format_object2(const char *format, const char **last, const void *object,
 				break;
 			}
 
-			ret = string_append(ret, &ltemp, 1);
+			template_add_literal(t, &ltemp, 1);
 			p += 2;
 		}
 			break;
@@ -181,35 +337,19 @@ format_object2(const char *format, const char **last, const void *object,
 			const size_t length = end - p + 1;
 
 			if (*end != '%') {
-				ret = string_append(ret, p, length - 1);
+				template_add_literal(t, p, length - 1);
 				p = end;
 				continue;
 			}
 
-			char name[32];
-			if (length > (int)sizeof(name)) {
-				ret = string_append(ret, p, length);
+			if (length > 32) {
+				/* too long to be a valid name */
+				template_add_literal(t, p, length);
 				p = end + 1;
 				continue;
 			}
 
-			memcpy(name, p + 1, length - 2);
-			name[length - 2] = 0;
-
-			const char *value = getter(object, name);
-			size_t value_length;
-			if (value != NULL) {
-				if (*value != 0)
-					found = true;
-				value_length = strlen(value);
-			} else {
-				/* unknown variable: copy verbatim
-				   from format string */
-				value = p;
-				value_length = length;
-			}
-
-			ret = string_append(ret, value, value_length);
+			template_add_attribute(t, p, length);
 
 			/* advance past the specifier */
 			p = end + 1;
@@ -219,7 +359,7 @@ format_object2(const char *format, const char **last, const void *object,
 		case '#':
 			/* let the escape character escape itself */
 			if (p[1] != '\0') {
-				ret = string_append(ret, p + 1, 1);
+				template_add_literal(t, p + 1, 1);
 				p += 2;
 				break;
 			}
@@ -228,19 +368,199 @@ format_object2(const char *format, const char **last, const void *object,
 
 		default:
 			/* pass-through non-escaped portions of the format string */
-			ret = string_append(ret, p, 1);
+			template_add_literal(t, p, 1);
 			++p;
 		}
 	}
 
-	if (last != NULL)
-		*last = p;
-	return ret;
+	/* close all unterminated groups; they keep their result
+	   even if nothing was found */
+	while (true) {
+		template_add_end(t, &stack[depth], false);
+		if (depth == 0)
+			break;
+		--depth;
+	}
+
+	free(stack);
+	return t;
+}
+
+void
+format_template_free(struct format_template *t)
+{
+	free(t->source);
+	free(t->ops);
+	free(t->text);
+	free(t);
+}
+
+/**
+ * Evaluate one group of the template, starting at the given
+ * operation index, and append its result to the buffer.  A discarded
+ * group (or section) is removed again by truncating the buffer to
+ * where it started.
+ *
+ * @param pc_r the index of the first operation of this group; on
+ * return, it is set to the index after the group's FORMAT_OP_END
+ * @return true if the group produced output (which may be an empty
+ * string), false if it was discarded
+ */
+static bool
+format_run(const struct format_template *t, unsigned *pc_r,
+	   struct mpc_buffer *dest, const void *object)
+{
+	const size_t start = dest->length;
+	bool has_output = false;
+	bool found = false;
+
+	unsigned pc = *pc_r;
+	while (true) {
+		assert(pc < t->n_ops);
+
+		const struct format_op *op = &t->ops[pc++];
+		switch (op->type) {
+		case FORMAT_OP_LITERAL:
+			mpc_buffer_append(dest, t->text + op->offset,
+					  op->length);
+			has_output = true;
+			break;
+
+		case FORMAT_OP_ATTRIBUTE: {
+			const char *value =
+				t->attributes->get(object, (int)op->arg);
+			size_t value_length;
+			if (value != NULL) {
+				if (*value != 0)
+					found = true;
+				value_length = strlen(value);
+			} else {
+				/* no value: copy verbatim from format
+				   string */
+				value = t->text + op->offset;
+				value_length = op->length;
+			}
+
+			mpc_buffer_append(dest, value, value_length);
+			has_output = true;
+		}
+			break;
+
+		case FORMAT_OP_GROUP:
+			if (format_run(t, &pc, dest, object)) {
+				has_output = true;
+				found = true;
+			}
+			break;
+
+		case FORMAT_OP_OR:
+			if (!found) {
+				/* nothing found yet: try the next
+				   section */
+				mpc_buffer_truncate(dest, start);
+				has_output = false;
+			} else
+				/* already found a value: skip the
+				   next section */
+				pc = op->arg;
+			break;
+
+		case FORMAT_OP_AND:
+			if (!found)
+				/* nothing found yet, so skip this
+				   section */
+				pc = op->arg;
+			else
+				/* we found something yet, but it will
+				   only be used if the next section
+				   also found something, so reset the
+				   flag */
+				found = false;
+			break;
+
+		case FORMAT_OP_END:
+			*pc_r = pc;
+
+			if (op->arg && !found) {
+				mpc_buffer_truncate(dest, start);
+				return false;
+			}
+
+			return has_output;
+		}
+	}
+}
+
+uint64_t
+format_template_attribute_mask(const struct format_template *t)
+{
+	return t->attribute_mask;
+}
+
+bool
+format_template_write(const struct format_template *t,
+		      struct mpc_buffer *dest, const void *object)
+{
+	unsigned pc = 0;
+	return format_run(t, &pc, dest, object);
+}
+
+char *
+format_template_apply(const struct format_template *t, const void *object)
+{
+	struct mpc_buffer buffer;
+	mpc_buffer_init(&buffer);
+
+	if (!format_template_write(t, &buffer, object)) {
+		mpc_buffer_deinit(&buffer);
+		return NULL;
+	}
+
+	return buffer.data;
+}
+
+/**
+ * The number of compiled templates kept by format_template_get().
+ * mpc usually uses only one song format and one status format.
+ */
+enum { FORMAT_CACHE_SIZE = 4 };
+
+static struct format_template *format_cache[FORMAT_CACHE_SIZE];
+static unsigned format_cache_next;
+
+const struct format_template *
+format_template_get(const char *format,
+		    const struct format_attributes *attributes)
+{
+	for (unsigned i = 0; i < FORMAT_CACHE_SIZE; ++i)
+		if (format_cache[i] != NULL &&
+		    format_cache[i]->attributes == attributes &&
+		    strcmp(format_cache[i]->source, format) == 0)
+			return format_cache[i];
+
+	struct format_template **slot = &format_cache[format_cache_next];
+	format_cache_next = (format_cache_next + 1) % FORMAT_CACHE_SIZE;
+
+	if (*slot != NULL)
+		format_template_free(*slot);
+
+	*slot = format_compile(format, attributes);
+	return *slot;
 }
 
 char *
 format_object(const char *format, const void *object,
-	      const char *(*getter)(const void *object, const char *name))
+	      const struct format_attributes *attributes)
+{
+	return format_template_apply(format_template_get(format, attributes),
+				     object);
+}
+
+bool
+format_object_write(struct mpc_buffer *dest, const char *format,
+		    const void *object,
+		    const struct format_attributes *attributes)
 {
-	return format_object2(format, NULL, object, getter);
+	return format_template_write(format_template_get(format, attributes),
+				     dest, object);
 }
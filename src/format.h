@@ -6,26 +6,130 @@
 
 #include "Compiler.h"
 
+#include <stdbool.h>
+#include <stdint.h>
+
 struct mpd_song;
+struct mpc_buffer;
+
+/**
+ * Describes the attributes ("%name%") of one kind of object which
+ * can be pretty-printed.
+ */
+struct format_attributes {
+	/**
+	 * Map an attribute name to an id.  This is called only once
+	 * per attribute, when the format string is compiled.
+	 *
+	 * @return a non-negative id; -1 if the name is unknown (the
+	 * specifier is then copied verbatim)
+	 */
+	int (*resolve)(const char *name);
+
+	/**
+	 * Extract an attribute value from the object.
+	 *
+	 * @param id an id returned by resolve()
+	 * @return the attribute value; an empty string if the
+	 * attribute is not present in the object; NULL to copy the
+	 * specifier verbatim
+	 */
+	const char *(*get)(const void *object, int id);
+};
+
+/**
+ * A format string compiled into a flat list of operations, which can
+ * be applied to many objects without parsing the format string again.
+ */
+struct format_template;
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * Compile a format string.
+ *
+ * @param format the format string
+ * @param attributes the attributes which may be referenced by the
+ * format string; the pointer must remain valid as long as the
+ * template is used
+ * @return a new template to be freed with format_template_free()
+ */
+gcc_malloc
+struct format_template *
+format_compile(const char *format, const struct format_attributes *attributes);
+
+void
+format_template_free(struct format_template *t);
+
+/**
+ * Look up the compiled template for the given format string in a
+ * small per-process cache, compiling it on a miss.  The returned
+ * pointer is owned by the cache and may be invalidated by the next
+ * call.
+ */
+const struct format_template *
+format_template_get(const char *format,
+		    const struct format_attributes *attributes);
+
+/**
+ * Returns a bit mask of the attribute ids referenced by the template,
+ * regardless of whether they would be evaluated.  Ids 64 and above
+ * are not represented.
+ */
+gcc_pure
+uint64_t
+format_template_attribute_mask(const struct format_template *t);
+
+/**
+ * Pretty-print an object into a string using a compiled template.
+ *
+ * @param t the compiled template
+ * @param object the object
+ * @return the resulting string to be freed by free(); NULL if
+ * no format string group produced any output
+ */
+gcc_malloc
+char *
+format_template_apply(const struct format_template *t, const void *object);
+
+/**
+ * Like format_template_apply(), but append the result to a buffer
+ * instead of allocating a new string.  If no format string group
+ * produced any output, the buffer is left unmodified.
+ *
+ * @return true if output was produced (which may be an empty string)
+ */
+bool
+format_template_write(const struct format_template *t,
+		      struct mpc_buffer *dest, const void *object);
+
 /**
  * Pretty-print an object into a string using the given format
- * specification.
+ * specification.  The compiled template is cached, so calling this
+ * repeatedly with the same format string parses it only once.
  *
  * @param format the format string
  * @param object the object
- * @param getter a getter function that extracts a value from the object
+ * @param attributes describes the attributes of the object
  * @return the resulting string to be freed by free(); NULL if
  * no format string group produced any output
  */
 gcc_malloc
 char *
 format_object(const char *format, const void *object,
-	      const char *(*getter)(const void *object, const char *name));
+	      const struct format_attributes *attributes);
+
+/**
+ * Like format_object(), but append the result to a buffer.
+ *
+ * @return true if output was produced (which may be an empty string)
+ */
+bool
+format_object_write(struct mpc_buffer *dest, const char *format,
+		    const void *object,
+		    const struct format_attributes *attributes);
 
 #ifdef __cplusplus
 }
@@ -3,6 +3,7 @@
 
 #include "idle.h"
 #include "util.h"
+#include "writer.h"
 
 #include <mpd/client.h>
 
@@ -50,7 +51,7 @@ cmd_idleloop(int argc, char **argv, struct mpd_connection *connection)
 {
 	while (true) {
 		int ret = cmd_idle(argc, argv, connection);
-		fflush(stdout);
+		writer_flush();
 		if (ret != 0)
 			return ret;
 	}
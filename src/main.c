@@ -4,7 +4,6 @@
 #include "list.h"
 #include "binary.h"
 #include "charset.h"
-#include "password.h"
 #include "util.h"
 #include "args.h"
 #include "status.h"
@@ -17,13 +16,20 @@
 #include "message.h"
 #include "mount.h"
 #include "neighbors.h"
+#include "proxy.h"
 #include "search.h"
+#include "trace.h"
 #include "mpc.h"
 #include "options.h"
+#include "song_format.h"
+#include "writer.h"
+#include "config.h"
 
 #include <mpd/client.h>
 
 #include <assert.h>
+#include <errno.h>
+#include <setjmp.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -33,11 +39,18 @@
 #include <unistd.h>
 #endif
 
+static int
+cmd_batch(int argc, char **argv, struct mpd_connection *conn);
+
+static int
+cmd_commands(int argc, char **argv, struct mpd_connection *conn);
+
 static const struct command {
 	const char *command;
 	const int min, max;   /* min/max arguments allowed, -1 = unlimited */
 	int pipe;             /**
-	                       * 1: implicit pipe read, `-' optional as argv[2]
+	                       * 1: implicit pipe read, `-' optional as argv[2];
+	                       *    the handler reads stdin by itself
 	                       * 2: explicit pipe read, `-' needed as argv[2]
 						   * 3: implicit pipe read, `-' optional as argv[3]
 	                       */
@@ -47,20 +60,23 @@ static const struct command {
 	/** NULL means they won't be shown in help */
 	const char *help;
 } mpc_table [] = {
+	/* in the order of "mpc help"; keep #command_index in sync */
 	/* command,     min, max, pipe, handler,         usage, help */
 	{"add",              0, -1, 1, cmd_add,              "<uri>", "Add a song to the queue"},
 	{"addplaylist",      2, -1, 3, cmd_addplaylist,      "<file> <uri> ...", "Add a song to the playlist"},
-	{"albumart",         1,  1, 0, cmd_albumart,         "<uri>", "Download album art for the given song and write to stdout." },
+	{"albumart",         1,  1, 1, cmd_albumart,         "<uri>", "Download album art for the given song and write to stdout." },
+	{"batch",            0,  1, 0, cmd_batch,            "[<file>|-]", "Run commands read from <file> or stdin over one connection"},
 	{"cdprev",           0,  0, 0, cmd_cdprev,           "", "Compact disk player-like previous command"},
 	{"channels",         0,  0, 0, cmd_channels,         "", "List the channels that other clients have subscribed to." },
 	{"clear",            0,  0, 0, cmd_clear,            "", "Clear the queue"},
 	{"clearerror",       0,  0, 0, cmd_clearerror,       "", "Clear the current error"},
 	{"clearplaylist",    1,  1, 0, cmd_clearplaylist,    "<file>", "Clear the playlist"},
+	{"commands",         0,  0, 0, cmd_commands,         "", "List the names of all commands (for completion)"},
 	{"consume",          0,  1, 0, cmd_consume,          "<on|once|off>", "Toggle consume mode, or specify state"},
 	{"crop",             0,  0, 0, cmd_crop,             "", "Remove all but the currently playing song"},
 	{"crossfade",        0,  1, 0, cmd_crossfade,        "[<seconds>]", "Set and display crossfade settings"},
 	{"current",          0,  0, 0, cmd_current,          "", "Show the currently playing song"},
-	{"del",              0, -1, 1, cmd_del,              "<position>", "Remove a song from the queue"},
+	{"del",              0, -1, 1, cmd_del,              "<position|id:<id>>", "Remove a song from the queue"},
 	{"delpart",          1, -1, 0, cmd_partitiondelete,  "<name> ...", "Delete partition(s)"},
 	{"delplaylist",      1, -1, 3, cmd_delplaylist,      "<file> <position> ...", "Remove a song from the playlist"},
 	{"disable",          1, -1, 0, cmd_disable,          "[only] <output # or name> [...]", "Disable output(s)"},
@@ -97,9 +113,12 @@ static const struct command {
 	{"playlist",         0,  1, 0, cmd_playlist,         "[<playlist>]", "Print <playlist>"},
 	{"prev",             0,  0, 0, cmd_prev,             "", "Play the previous song in the queue"},
 	{"prio",             2, -1, 2, cmd_prio,             "<prio> <position/range> ...", "Change song priorities in the queue"},
+#ifdef ENABLE_PROXY
+	{"proxy",            0,  0, 0, cmd_proxy,            "", "Share MPD connections with other mpc processes (see --listen)"},
+#endif
 	{"queued",	         0,  0, 0, cmd_queued,           "", "Show the next queued song"},
 	{"random",           0,  1, 0, cmd_random,           "<on|off>", "Toggle random mode, or specify state"},
-	{"readpicture",      1, 1, 0,  cmd_readpicture,      "<uri>", "Download a picture from the given song and write to stdout." },
+	{"readpicture",      1, 1, 1,  cmd_readpicture,      "<uri>", "Download a picture from the given song and write to stdout." },
 	{"renplaylist",      2,  2, 0, cmd_renplaylist,      "<file> <newfile>", "Rename a playlist"},
 	{"repeat",           0,  1, 0, cmd_repeat,           "<on|off>", "Toggle repeat mode, or specify state"},
 	{"replaygain",       0, -1, 0, cmd_replaygain,       "[off|track|album]", "Set or display the replay gain mode" },
@@ -133,6 +152,83 @@ static const struct command {
 	{ .command = NULL }
 };
 
+/**
+ * The number of entries in #mpc_table, without the terminator.
+ */
+#define MPC_TABLE_SIZE (sizeof(mpc_table) / sizeof(mpc_table[0]) - 1)
+
+/**
+ * The positions of all entries of #mpc_table, sorted by name (in
+ * strcmp() order), for the binary search in find_command().  When
+ * adding a command, insert its position here and renumber the ones
+ * after it; debug builds check this index with
+ * is_command_index_valid().
+ */
+static const unsigned char command_index[MPC_TABLE_SIZE] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+	10, 11, 12, 13, 14, 15, 16, 17, 18, 19,
+	20, 21, 22, 23, 24, 25, 26, 27, 28, 29,
+	31, 30, 32, 33, 34, 35, 36, 37, 38, 40,
+	39, 41, 42, 43, 44, 45, 46, 47, 48, 49,
+	50,
+#ifdef ENABLE_PROXY
+	51,
+#define AFTER_PROXY 52
+#else
+#define AFTER_PROXY 51
+#endif
+	/* the positions after the optional "proxy" entry */
+	AFTER_PROXY + 0, AFTER_PROXY + 1, AFTER_PROXY + 2, AFTER_PROXY + 3,
+	AFTER_PROXY + 4, AFTER_PROXY + 5, AFTER_PROXY + 6, AFTER_PROXY + 7,
+	AFTER_PROXY + 8, AFTER_PROXY + 9, AFTER_PROXY + 10, AFTER_PROXY + 11,
+	AFTER_PROXY + 12, AFTER_PROXY + 13, AFTER_PROXY + 14, AFTER_PROXY + 15,
+	AFTER_PROXY + 16, AFTER_PROXY + 17, AFTER_PROXY + 18, AFTER_PROXY + 19,
+	AFTER_PROXY + 20, AFTER_PROXY + 21, AFTER_PROXY + 22, AFTER_PROXY + 23,
+	AFTER_PROXY + 24, AFTER_PROXY + 25, AFTER_PROXY + 26, AFTER_PROXY + 27,
+	AFTER_PROXY + 28, AFTER_PROXY + 29, AFTER_PROXY + 30,
+#undef AFTER_PROXY
+};
+
+static const struct command *
+sorted_command(unsigned i)
+{
+	return &mpc_table[command_index[i]];
+}
+
+#ifndef NDEBUG
+
+/**
+ * Is #command_index strictly sorted?  Since the names in
+ * #mpc_table are unique, this also means that it contains each
+ * entry once.
+ */
+gcc_pure
+static bool
+is_command_index_valid(void)
+{
+	for (unsigned i = 0; i < MPC_TABLE_SIZE; ++i)
+		if (command_index[i] >= MPC_TABLE_SIZE ||
+		    (i > 0 && strcmp(sorted_command(i - 1)->command,
+				     sorted_command(i)->command) >= 0))
+			return false;
+
+	return true;
+}
+
+#endif
+
+static int
+cmd_commands(gcc_unused int argc, gcc_unused char **argv,
+	     gcc_unused struct mpd_connection *conn)
+{
+	/* like "mpc help", this omits the hidden commands */
+	for (unsigned i = 0; i < MPC_TABLE_SIZE; ++i)
+		if (sorted_command(i)->help != NULL)
+			printf("%s\n", sorted_command(i)->command);
+
+	return 0;
+}
+
 static void
 print_usage(FILE *outfp, const char *progname)
 {
@@ -189,6 +285,11 @@ print_help(const char *progname, const char *command)
 static struct mpd_connection *
 setup_connection(void)
 {
+#ifdef ENABLE_TRACE
+	if (options.trace)
+		trace_begin();
+#endif
+
 	struct mpd_connection *conn = mpd_connection_new(options.host, options.port, 0);
 	if (conn == NULL) {
 		fputs("Out of memory\n", stderr);
@@ -198,33 +299,62 @@ setup_connection(void)
 	if (mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS)
 		printErrorAndExit(conn);
 
-	if(options.password)
-		send_password(options.password, conn);
+#ifdef ENABLE_TRACE
+	if (options.trace)
+		conn = trace_connect(conn);
+#endif
 
 	return conn;
 }
 
+/**
+ * Look up a command by its name or by an unambiguous prefix of it.
+ * In #command_index, all commands beginning with the given prefix
+ * are adjacent, and the first of them is found with a binary search;
+ * if it is not an exact match, the prefix is unambiguous if the next
+ * command does not begin with it.
+ */
 static const struct command *
 find_command(const char *name)
 {
-	unsigned n_matches = 0;
-	size_t name_length = strlen(name);
-	const struct command *command = NULL;
-
-	for (unsigned i = 0; mpc_table[i].command != NULL; ++i) {
-		if (memcmp(name, mpc_table[i].command, name_length) == 0) {
-			command = &mpc_table[i];
-			++n_matches;
+#ifndef NDEBUG
+	static bool checked;
+	if (!checked) {
+		assert(is_command_index_valid());
+		checked = true;
+	}
+#endif
 
-			if (command->command[name_length] == 0)
-				/* exact match */
-				return &mpc_table[i];
-		}
+	unsigned low = 0, high = MPC_TABLE_SIZE;
+	while (low < high) {
+		const unsigned middle = (low + high) / 2;
+		if (strcmp(sorted_command(middle)->command, name) < 0)
+			low = middle + 1;
+		else
+			high = middle;
 	}
 
-	return n_matches == 1
-		? command
-		: /* ambiguous or nonexistent */ NULL;
+	if (low == MPC_TABLE_SIZE)
+		return NULL;
+
+	const size_t name_length = strlen(name);
+	const struct command *command = sorted_command(low);
+
+	if (strncmp(command->command, name, name_length) != 0)
+		/* nonexistent */
+		return NULL;
+
+	if (command->command[name_length] == 0)
+		/* exact match */
+		return command;
+
+	if (low + 1 < MPC_TABLE_SIZE &&
+	    strncmp(sorted_command(low + 1)->command, name,
+		    name_length) == 0)
+		/* ambiguous */
+		return NULL;
+
+	return command;
 }
 
 /**
@@ -233,39 +363,167 @@ find_command(const char *name)
  */
 static bool pipe_array_used = false;
 
-/* check arguments to see if they are valid */
+/**
+ * Check the number of arguments, and print the usage if it is wrong.
+ */
+gcc_pure
+static bool
+is_arg_count_valid(const struct command *command, int argc)
+{
+	return (-1 == command->min || argc >= command->min) &&
+		(-1 == command->max || argc <= command->max);
+}
+
+static bool
+check_arg_count(const struct command *command, int argc,
+		const char *progname)
+{
+	if (!is_arg_count_valid(command, argc)) {
+		fprintf(stderr,"usage: %s %s %s\n", progname, command->command,
+			command->usage);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Do the given arguments make the command read stdin (see
+ * #command::pipe)?
+ *
+ * @param argc the number of arguments after the command name
+ */
+gcc_pure
+static bool
+reads_stdin(const struct command *command, int argc, char **argv)
+{
+	switch (command->pipe) {
+	case 1:
+		return argc == 0 || is_stdin_argument(argc, argv);
+
+	case 2:
+		return is_stdin_argument(argc, argv);
+
+	case 3:
+		return argc == 1 ||
+			(argc == 2 && strcmp(argv[1], STDIN_SYMBOL) == 0);
+
+	default:
+		return false;
+	}
+}
+
+/**
+ * Build the argument array of a command, reading the arguments from
+ * stdin if the command does that (see reads_stdin()).
+ *
+ * @param argc the number of arguments after the command name; it is
+ * updated
+ * @param pipe_array_r set to true if the array elements have been
+ * read from stdin and must be freed with free_pipe_array()
+ * @return an allocated array, or NULL if the number of arguments is
+ * wrong (after printing the usage)
+ */
 static char **
-check_args(const struct command *command, int * argc, char ** argv)
+build_args(const struct command *command, int *argc, char **argv,
+	   const char *progname, bool *pipe_array_r)
 {
 	char ** array;
 
-	if ((command->pipe == 1 &&
-		(2==*argc || (3==*argc && 0==strcmp(argv[2],STDIN_SYMBOL) )))
-	    || (command->pipe == 2 && (3 == *argc &&
-				       0 == strcmp(argv[2],STDIN_SYMBOL)))){
-		*argc = stdinToArgArray(&array);
-		pipe_array_used = true;
-
-	} else if (command->pipe == 3 && ((*argc == 3) || ((*argc == 4) && !strcmp(argv[3], STDIN_SYMBOL)))) {
-		*argc = stdinAndPreambleToArgArray(&array, argv[2]);
-		pipe_array_used = true;
+	*pipe_array_r = false;
 
-	} else {
-		*argc -= 2;
+	if (!reads_stdin(command, *argc, argv)) {
 		array = malloc( (*argc * (sizeof(char *))));
 		for(int i = 0; i < *argc; ++i) {
-			array[i]=argv[i+2];
+			array[i]=argv[i];
 		}
+	} else if (command->pipe == 1) {
+		/* the handler streams stdin in chunks (see
+		   is_stdin_argument()) */
+		static char stdin_symbol[] = STDIN_SYMBOL;
+
+		*argc = 1;
+		array = malloc(sizeof(*array));
+		array[0] = stdin_symbol;
+
+	} else if (command->pipe == 2) {
+		*argc = stdinToArgArray(&array);
+		*pipe_array_r = true;
+
+	} else {
+		*argc = stdinAndPreambleToArgArray(&array, argv[0]);
+		*pipe_array_r = true;
 	}
-	if ((-1 != command->min && *argc < command->min) ||
-	    (-1 != command->max && *argc > command->max)) {
-		fprintf(stderr,"usage: %s %s %s\n", argv[0], command->command,
-			command->usage);
-			exit (EXIT_FAILURE);
+
+	if (!check_arg_count(command, *argc, progname)) {
+		if (*pipe_array_r)
+			free_pipe_array(*argc, array);
+		free(array);
+		return NULL;
 	}
+
 	return array;
 }
 
+/* check arguments to see if they are valid */
+static char **
+check_args(const struct command *command, int * argc, char ** argv)
+{
+	*argc -= 2;
+
+	char **array = build_args(command, argc, argv + 2, argv[0],
+				  &pipe_array_used);
+	if (array == NULL)
+		exit(EXIT_FAILURE);
+
+	return array;
+}
+
+/**
+ * Handlers which only send commands whose response is "OK" (or
+ * which read nothing but getStatus() first).  Their commands are
+ * appended to the shared command list, which begins with "password"
+ * and "partition" (see deferred_setup()), and in a chain with the
+ * commands before them (see deferred_enable()).  All other handlers
+ * read responses, and the pending command list is flushed before
+ * they run.
+ */
+static int (*const deferrable_handlers[])(int argc, char **argv,
+					   struct mpd_connection *conn) = {
+	cmd_next, cmd_prev, cmd_stop, cmd_clearerror, cmd_play, cmd_pause,
+	cmd_toggle, cmd_save, cmd_rm, cmd_clear, cmd_shuffle, cmd_add,
+	cmd_del, cmd_crop, cmd_prio, cmd_volume, cmd_repeat, cmd_random,
+	cmd_single, cmd_consume,
+	NULL
+};
+
+gcc_pure
+static bool
+is_deferrable(const struct command *command)
+{
+	for (unsigned i = 0; deferrable_handlers[i] != NULL; ++i)
+		if (deferrable_handlers[i] == command->handler)
+			return true;
+
+	return false;
+}
+
+/**
+ * Does this command run without a connection set up by run()?
+ */
+gcc_pure
+static bool
+needs_no_connection(const struct command *command)
+{
+#ifdef ENABLE_PROXY
+	/* the proxy opens its connections itself */
+	if (command->handler == cmd_proxy)
+		return true;
+#endif
+
+	return command->handler == cmd_commands;
+}
+
 static int
 run(const struct command *command, int argc, char **array)
 {
@@ -278,13 +536,15 @@ run(const struct command *command, int argc, char **array)
 	   an output.  Not all outputs are visible in a partition, and
 	   moveoutput needs to look up the one to move, so it has to start
 	   in the default partition. */
-	if (options.partition != NULL && command->handler != cmd_moveoutput) {
-		if (!mpd_run_switch_partition(conn, options.partition)) {
-			printErrorAndExit(conn);
-		}
-	}
+	deferred_setup(conn, options.password,
+		       command->handler != cmd_moveoutput
+		       ? options.partition : NULL);
+
+	if (!is_deferrable(command))
+		deferred_flush(conn);
 
 	int ret = command->handler(argc, array, conn);
+	deferred_flush(conn);
 	if (ret > 0 && options.verbosity > V_QUIET) {
 		print_status(conn);
 	}
@@ -293,12 +553,322 @@ run(const struct command *command, int argc, char **array)
 	return (ret >= 0) ? EXIT_SUCCESS : -ret;
 }
 
+/**
+ * The separator between chained commands.  The shell requires it to
+ * be quoted, e.g. "mpc random on \\; play".
+ */
+static const char chain_separator[] = ";";
+
+/**
+ * Is argv[i] a chain separator?  Only a ";" between two complete
+ * commands is one: the command beginning at argv[start] must accept
+ * the number of arguments before it, and the next argument must be a
+ * command name.  Any other ";" is an argument, e.g. in
+ * "mpc search title \;".
+ */
+gcc_pure
+static bool
+is_chain_separator(int argc, char **argv, int start, int i)
+{
+	if (strcmp(argv[i], chain_separator) != 0 ||
+	    i == start || i + 1 >= argc)
+		return false;
+
+	const struct command *command = find_command(argv[start]);
+	return command != NULL &&
+		is_arg_count_valid(command, i - start - 1) &&
+		find_command(argv[i + 1]) != NULL;
+}
+
+gcc_pure
+static bool
+contains_chain_separator(int argc, char **argv)
+{
+	/* the first separator ends the first command */
+	for (int i = 2; i < argc; ++i)
+		if (is_chain_separator(argc, argv, 1, i))
+			return true;
+
+	return false;
+}
+
+/**
+ * Look up and validate all commands of a chain before anything is
+ * sent to MPD.  The separators in "argv" are replaced with NULL.
+ *
+ * @return the number of commands, or 0 on error
+ */
+static unsigned
+parse_chain(int argc, char **argv, const struct command **commands)
+{
+	unsigned n = 0;
+	int start = 1;
+
+	for (int i = 1; i <= argc; ++i) {
+		if (i < argc && !is_chain_separator(argc, argv, start, i))
+			continue;
+
+		const int segment_argc = i - start;
+		if (i < argc)
+			argv[i] = NULL;
+
+		if (segment_argc == 0) {
+			fprintf(stderr, "empty command in chain\n");
+			return 0;
+		}
+
+		const struct command *command = find_command(argv[start]);
+		if (command == NULL) {
+			print_help("mpc", argv[start]);
+			return 0;
+		}
+
+		if (command->handler == cmd_batch ||
+		    command->handler == cmd_commands ||
+#ifdef ENABLE_PROXY
+		    command->handler == cmd_proxy ||
+#endif
+		    command->handler == cmd_moveoutput) {
+			fprintf(stderr, "\"%s\" cannot be chained\n",
+				command->command);
+			return 0;
+		}
+
+		if (!check_arg_count(command, segment_argc - 1, argv[0]))
+			return 0;
+
+		if (command->pipe == 1 && segment_argc == 1) {
+			/* outside of a chain, this would read stdin */
+			fprintf(stderr, "\"%s\" needs arguments in a chain "
+				"(\"-\" reads them from stdin)\n",
+				command->command);
+			return 0;
+		}
+
+		commands[n++] = command;
+		start = i + 1;
+	}
+
+	return n;
+}
+
+/**
+ * Run several commands separated by ";" over one connection.
+ * Consecutive commands which do not read a response are sent in one
+ * command list.  Each command gets MPD's default tag types, even if
+ * the one before it has changed them.  The chain stops at the first
+ * command which fails.
+ */
+static int
+run_chain(int argc, char **argv)
+{
+	const struct command **commands =
+		malloc(argc * sizeof(*commands));
+	const unsigned n = parse_chain(argc, argv, commands);
+	if (n == 0) {
+		free(commands);
+		return EXIT_FAILURE;
+	}
+
+	struct mpd_connection *conn = setup_connection();
+
+	if (mpd_connection_cmp_server_version(conn, 0, 21, 0) < 0)
+		fprintf(stderr, "warning: MPD 0.21 required\n");
+
+	deferred_setup(conn, options.password, options.partition);
+	deferred_enable();
+
+	bool print = false;
+	int ret = 0;
+	char **segment = argv + 1;
+
+	for (unsigned i = 0; i < n; ++i) {
+		int segment_argc = 0;
+		while (segment + segment_argc < argv + argc &&
+		       segment[segment_argc] != NULL)
+			++segment_argc;
+
+		/* "tagtypes all" is sent together with the next
+		   command (see deferred_setup()) */
+		deferred_reset_tag_types(conn);
+		if (!is_deferrable(commands[i]))
+			deferred_flush(conn);
+
+		ret = commands[i]->handler(segment_argc - 1, segment + 1,
+					   conn);
+		if (ret < 0)
+			break;
+		if (ret > 0)
+			print = true;
+
+		segment += segment_argc + 1;
+	}
+
+	deferred_flush(conn);
+
+	if (print && ret >= 0 && options.verbosity > V_QUIET)
+		print_status(conn);
+
+	mpd_connection_free(conn);
+	free(commands);
+	return (ret >= 0) ? EXIT_SUCCESS : -ret;
+}
+
+/**
+ * Run one command of a batch.  Errors which would exit the process
+ * (printErrorAndExit(), abort_command()) only abort this command.
+ *
+ * @return the exit status of the command
+ */
+static int
+run_batch_command(const struct command *command, int argc, char **argv,
+		  struct mpd_connection *conn)
+{
+	jmp_buf abort_target;
+	int status = setjmp(abort_target);
+	if (status != 0) {
+		set_command_abort_target(NULL);
+		return status;
+	}
+
+	set_command_abort_target(&abort_target);
+
+	/* the previous line may have changed the tag types */
+	deferred_reset_tag_types(conn);
+	if (!is_deferrable(command))
+		deferred_flush(conn);
+
+	int ret = command->handler(argc, argv, conn);
+	deferred_flush(conn);
+	if (ret > 0 && options.verbosity > V_QUIET)
+		print_status(conn);
+
+	set_command_abort_target(NULL);
+	return (ret >= 0) ? EXIT_SUCCESS : -ret;
+}
+
+/**
+ * Parse and run one line of a batch.  Arguments are read from stdin
+ * like on the command line (see reads_stdin()).
+ *
+ * @param from_stdin is the batch read from stdin?  Then commands
+ * reading stdin (e.g. "add -" or "add") are rejected, because they
+ * would consume the rest of the batch.
+ * @return the exit status of the command
+ */
+static int
+run_batch_line(char *line, bool from_stdin, struct mpd_connection *conn)
+{
+	char **argv;
+	int argc = split_command_line(line, &argv);
+	if (argc < 0) {
+		fprintf(stderr, "unterminated quote\n");
+		return EXIT_FAILURE;
+	}
+
+	if (argc == 0) {
+		/* empty line or comment */
+		free(argv);
+		return EXIT_SUCCESS;
+	}
+
+	const struct command *command = find_command(argv[0]);
+	int status = EXIT_FAILURE;
+	if (command == NULL)
+		fprintf(stderr, "unknown command \"%s\"\n", argv[0]);
+	else if (command->handler == cmd_batch)
+		fprintf(stderr, "\"batch\" cannot be nested\n");
+	else if (from_stdin && reads_stdin(command, argc - 1, argv + 1))
+		fprintf(stderr, "\"%s\" cannot read stdin while the "
+			"batch is read from stdin\n", command->command);
+	else {
+		int args_argc = argc - 1;
+		bool pipe_array;
+		char **args = build_args(command, &args_argc, argv + 1,
+					 "mpc", &pipe_array);
+		if (args != NULL) {
+			status = run_batch_command(command, args_argc, args,
+						   conn);
+
+			if (pipe_array)
+				free_pipe_array(args_argc, args);
+			free(args);
+		}
+	}
+
+	free(argv);
+	return status;
+}
+
+static int
+cmd_batch(int argc, char **argv, struct mpd_connection *conn)
+{
+	FILE *file = stdin;
+	if (argc > 0 && strcmp(argv[0], STDIN_SYMBOL) != 0) {
+		file = fopen(argv[0], "r");
+		if (file == NULL) {
+			fprintf(stderr, "Failed to open %s: %s\n",
+				argv[0], strerror(errno));
+			return -1;
+		}
+	}
+
+	char *line = NULL;
+	size_t line_size = 0;
+	unsigned line_number = 0, n_failed = 0;
+
+	while (getline(&line, &line_size, file) >= 0) {
+		++line_number;
+
+		const int status = run_batch_line(line, file == stdin, conn);
+		if (status != EXIT_SUCCESS || options.verbosity > V_DEFAULT) {
+			writer_flush();
+			fprintf(stderr, "batch: line %u: exit status %d\n",
+				line_number, status);
+		}
+
+		if (status == EXIT_SUCCESS)
+			continue;
+
+		++n_failed;
+
+		/* the command may have left a command list or a
+		   search unfinished */
+		if (!resync_connection(conn)) {
+			/* the connection is broken; the remaining
+			   commands cannot run */
+			fprintf(stderr, "batch: aborted after line %u\n",
+				line_number);
+			break;
+		}
+	}
+
+	free(line);
+	if (file != stdin)
+		fclose(file);
+
+	return n_failed > 0 ? -EXIT_FAILURE : 0;
+}
+
 int main(int argc, char ** argv)
 {
+	writer_init();
+
 	parse_options(&argc, argv);
 
 	/* parse command and arguments */
 
+	if (contains_chain_separator(argc, argv)) {
+		charset_init(true, true);
+
+		if (options.tag_separator != NULL)
+			format_song_set_tag_separator(options.tag_separator);
+
+		const int ret = run_chain(argc, argv);
+		charset_deinit();
+		return ret;
+	}
+
 	const char *command_name;
 	if (argc >= 2)
 		command_name = argv[1];
@@ -321,9 +891,17 @@ int main(int argc, char ** argv)
 
 	charset_init(true, true);
 
+	if (options.tag_separator != NULL)
+		format_song_set_tag_separator(options.tag_separator);
+
 	/* run */
 
-	int ret = run(command, argc, argv);
+	int ret;
+	if (needs_no_connection(command))
+		ret = command->handler(argc, argv, NULL) >= 0
+			? EXIT_SUCCESS : EXIT_FAILURE;
+	else
+		ret = run(command, argc, argv);
 
 	/* cleanup */
 
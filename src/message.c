@@ -4,6 +4,7 @@
 #include "message.h"
 #include "util.h"
 #include "charset.h"
+#include "writer.h"
 #include "Compiler.h"
 
 #include <mpd/client.h>
@@ -68,6 +69,9 @@ cmd_subscribe(gcc_unused int argc, char **argv,
 		printErrorAndExit(connection);
 
 	while (true) {
+		/* show what we have before waiting for more */
+		writer_flush();
+
 		if (!mpd_run_idle_mask(connection, MPD_IDLE_MESSAGE) ||
 		    !mpd_send_read_messages(connection))
 			printErrorAndExit(connection);
@@ -20,6 +20,12 @@
 enum ShortOption {
 	OPTION_NONE,
 	OPTION_WITH_PRIO,
+	OPTION_TAG_SEPARATOR,
+	OPTION_LISTEN,
+	OPTION_TRACE,
+	OPTION_OUTPUT_DIR,
+	OPTION_ART_CACHE,
+	OPTION_PAGE_SIZE,
 };
 
 struct OptionDef {
@@ -47,8 +53,20 @@ static const struct OptionDef option_table[] = {
 	{ 'f', "format", "<format>", "Print status with format <format>" },
 	{ 'w', "wait", NULL, "Wait for operation to finish (e.g. database update)" },
 	{ 'r', "range", "[<start>]:[<end>]", "Operate on a range (e.g. when loading a playlist)" },
+	{ OPTION_PAGE_SIZE, "page-size", "<n>", "Fetch search results and the queue <n> songs at a time" },
 	{ 'a', "partition", "<name>", "Operate on partition <name> instead" },
 	{ OPTION_WITH_PRIO, "with-prio", NULL, "Show only songs that have a non-zero priority" },
+	{ OPTION_TAG_SEPARATOR, "tag-separator", "<separator>", "Separate multiple tag values with <separator> (default \", \")" },
+#ifdef ENABLE_PROXY
+	{ OPTION_LISTEN, "listen", "<path>", "Socket path for the \"proxy\" command" },
+#endif
+#ifdef ENABLE_TRACE
+	{ OPTION_TRACE, "trace", NULL, "Print protocol timing to stderr" },
+#endif
+	{ OPTION_OUTPUT_DIR, "output-dir", "<directory>", "Write pictures to files in <directory>" },
+#ifdef ENABLE_ART_CACHE
+	{ OPTION_ART_CACHE, "art-cache", NULL, "Cache album art in $XDG_CACHE_HOME/mpc/art" },
+#endif
 };
 
 static const unsigned option_table_size = sizeof(option_table) / sizeof(option_table[0]);
@@ -133,6 +151,19 @@ ParseRange(struct Range *r, const char *s)
 		r->end = UINT_MAX;
 }
 
+static void
+ParsePageSize(const char *s)
+{
+	char *endptr;
+	const unsigned long value = strtoul(s, &endptr, 10);
+	if (endptr == s || *endptr != 0 || value > UINT_MAX) {
+		fprintf(stderr, "Failed to parse page size '%s'\n", s);
+		exit(EXIT_FAILURE);
+	}
+
+	options.page_size = value;
+}
+
 static void
 handle_option(int c, const char *arg)
 {
@@ -172,6 +203,36 @@ handle_option(int c, const char *arg)
 		options.with_prio = true;
 		break;
 
+	case OPTION_TAG_SEPARATOR:
+		options.tag_separator = arg;
+		break;
+
+#ifdef ENABLE_PROXY
+	case OPTION_LISTEN:
+		options.listen = arg;
+		break;
+#endif
+
+#ifdef ENABLE_TRACE
+	case OPTION_TRACE:
+		options.trace = true;
+		break;
+#endif
+
+	case OPTION_OUTPUT_DIR:
+		options.output_dir = arg;
+		break;
+
+#ifdef ENABLE_ART_CACHE
+	case OPTION_ART_CACHE:
+		options.art_cache = true;
+		break;
+#endif
+
+	case OPTION_PAGE_SIZE:
+		ParsePageSize(arg);
+		break;
+
 	default: // Should never be reached, due to lookup_*_option functions
 		fprintf(stderr, "Unknown option %c = %s\n", c, arg);
 		exit(EXIT_FAILURE);
@@ -332,6 +393,22 @@ parse_options(int * argc_p, char ** argv)
 			options.custom_format = true;
 	}
 
+#ifdef ENABLE_TRACE
+	if (!options.trace) {
+		const char *trace = getenv("MPC_TRACE");
+		options.trace = trace != NULL && *trace != 0 &&
+			strcmp(trace, "0") != 0;
+	}
+#endif
+
+#ifdef ENABLE_ART_CACHE
+	if (!options.art_cache) {
+		const char *art_cache = getenv("MPC_ART_CACHE");
+		options.art_cache = art_cache != NULL && *art_cache != 0 &&
+			strcmp(art_cache, "0") != 0;
+	}
+#endif
+
 	/* Fix argv for command processing, which wants
 	   argv[1] to be the command, and so on. */
 	if (cmdind != 0)
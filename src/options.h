@@ -4,6 +4,7 @@
 #ifndef OPTIONS_H
 #define OPTIONS_H
 
+#include <limits.h>
 #include <stdbool.h>
 
 #define V_QUIET 0
@@ -16,6 +17,15 @@ struct Range {
 	unsigned start, end;
 };
 
+/**
+ * Does the range select everything (i.e. "--range" was not given)?
+ */
+static inline bool
+range_is_full(const struct Range *r)
+{
+	return r->start == 0 && r->end == UINT_MAX;
+}
+
 struct Options {
 	const char *host;
 	const char *port_str;
@@ -23,15 +33,27 @@ struct Options {
 	int port;
 	const char *password;
 	const char *format;
+	const char *tag_separator;
+	const char *listen;
+	const char *output_dir;
 
 	struct Range range;
 
+	/**
+	 * Fetch songs in windows of this size (0 = all at once).
+	 */
+	unsigned page_size;
+
 	int verbosity; // 0 for quiet, 1 for default, 2 for verbose
 	bool wait;
 
 	bool custom_format;
 
 	bool with_prio;
+
+	bool trace;
+
+	bool art_cache;
 };
 
 
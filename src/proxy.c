@@ -0,0 +1,1418 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "proxy.h"
+#include "buffer.h"
+#include "options.h"
+#include "Compiler.h"
+
+#include <mpd/client.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+enum {
+	/**
+	 * The number of shared MPD connections.
+	 */
+	POOL_SIZE = 4,
+
+	/**
+	 * A client whose incomplete request grows beyond this size is
+	 * disconnected.  MPD's default "max_command_list_size" is
+	 * 2 MiB.
+	 */
+	MAX_REQUEST = 4 * 1024 * 1024,
+
+	/**
+	 * Stop reading a response from MPD while the client it is
+	 * forwarded to has this much unsent output.
+	 */
+	MAX_BACKLOG = 1024 * 1024,
+
+	/**
+	 * Send "ping" on unused shared connections after this many
+	 * seconds, so MPD's "connection_timeout" does not close them.
+	 */
+	KEEPALIVE_INTERVAL = 30,
+
+	RECEIVE_SIZE = 64 * 1024,
+};
+
+/**
+ * A byte queue: data is appended to the buffer and consumed from
+ * the front.
+ */
+struct fifo {
+	struct mpc_buffer buffer;
+	size_t start;
+};
+
+static void
+fifo_init(struct fifo *f)
+{
+	mpc_buffer_init(&f->buffer);
+	f->start = 0;
+}
+
+static void
+fifo_deinit(struct fifo *f)
+{
+	mpc_buffer_deinit(&f->buffer);
+}
+
+gcc_pure
+static size_t
+fifo_size(const struct fifo *f)
+{
+	return f->buffer.length - f->start;
+}
+
+/**
+ * Only valid if fifo_size() is not zero.
+ */
+gcc_pure
+static const char *
+fifo_data(const struct fifo *f)
+{
+	return f->buffer.data + f->start;
+}
+
+static void
+fifo_append(struct fifo *f, const char *data, size_t length)
+{
+	mpc_buffer_append(&f->buffer, data, length);
+}
+
+static void
+fifo_consume(struct fifo *f, size_t n)
+{
+	assert(n <= fifo_size(f));
+
+	f->start += n;
+
+	if (f->start == f->buffer.length) {
+		mpc_buffer_clear(&f->buffer);
+		f->start = 0;
+	} else if (f->start >= RECEIVE_SIZE &&
+		   f->start * 2 >= f->buffer.length) {
+		/* don't let a continuous stream grow the buffer */
+		const size_t size = fifo_size(f);
+		memmove(f->buffer.data, f->buffer.data + f->start, size);
+		mpc_buffer_truncate(&f->buffer, size);
+		f->start = 0;
+	}
+}
+
+/**
+ * @return false on error or end of file
+ */
+static bool
+fifo_receive(struct fifo *f, int fd)
+{
+	char *p = mpc_buffer_reserve(&f->buffer, RECEIVE_SIZE);
+	const ssize_t n = recv(fd, p, RECEIVE_SIZE, MSG_DONTWAIT);
+	if (n > 0) {
+		mpc_buffer_commit(&f->buffer, n);
+		return true;
+	}
+
+	return n < 0 &&
+		(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+}
+
+/**
+ * Send as much as possible without blocking.
+ *
+ * @return false on error
+ */
+static bool
+fifo_send(struct fifo *f, int fd)
+{
+	while (fifo_size(f) > 0) {
+		const ssize_t n = send(fd, fifo_data(f), fifo_size(f),
+				       MSG_DONTWAIT|MSG_NOSIGNAL);
+		if (n < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK ||
+				errno == EINTR;
+
+		fifo_consume(f, n);
+	}
+
+	return true;
+}
+
+/**
+ * Append a command with one argument, quoted like libmpdclient does.
+ */
+static void
+fifo_append_command(struct fifo *f, const char *command,
+		    const char *argument)
+{
+	fifo_append(f, command, strlen(command));
+	fifo_append(f, " \"", 2);
+
+	for (const char *p = argument; *p != 0; ++p) {
+		if (*p == '"' || *p == '\\')
+			fifo_append(f, "\\", 1);
+		fifo_append(f, p, 1);
+	}
+
+	fifo_append(f, "\"\n", 2);
+}
+
+gcc_pure
+static bool
+buffer_equals(const struct mpc_buffer *a, const struct mpc_buffer *b)
+{
+	return a->length == b->length &&
+		(a->length == 0 || memcmp(a->data, b->data, a->length) == 0);
+}
+
+struct client;
+
+/**
+ * A connection to MPD.
+ */
+struct upstream {
+	struct upstream *next;
+
+	int fd;
+
+	/**
+	 * Is the non-blocking connect() still in progress?
+	 */
+	bool connecting;
+
+	/**
+	 * Is the greeting of the server still expected?
+	 */
+	bool handshake;
+
+	/**
+	 * The number of entries at the front of #waiting which belong
+	 * to the commands setting up the connection ("password",
+	 * "partition").  An error response to one of them fails the
+	 * connection.
+	 */
+	unsigned n_setup;
+
+	/**
+	 * Is this connection in the pool?  If not, it is dedicated to
+	 * #owner.
+	 */
+	bool shared;
+
+	bool dead;
+
+	/**
+	 * The client this connection is dedicated to; NULL if it is
+	 * shared or if the client is gone.
+	 */
+	struct client *owner;
+
+	/**
+	 * Requests which have not been sent yet.
+	 */
+	struct fifo output;
+
+	/**
+	 * Response data which has not been forwarded yet.
+	 */
+	struct fifo input;
+
+	/**
+	 * The clients waiting for a response, oldest first.  The
+	 * responses for NULL entries are discarded.
+	 */
+	struct client **waiting;
+	unsigned n_waiting, max_waiting;
+
+	/**
+	 * The number of raw bytes remaining in the current "binary"
+	 * chunk, including the newline after it.
+	 */
+	size_t binary_remaining;
+
+	/**
+	 * The "tagtypes" commands applied to this shared connection
+	 * since "tagtypes all", i.e. the #client::tagtypes of the
+	 * client which submitted the last request.
+	 */
+	struct mpc_buffer tagtypes;
+
+	/**
+	 * Has an error response made #tagtypes unreliable, because
+	 * MPD skipped the rest of a command list?
+	 */
+	bool tagtypes_unknown;
+
+	/**
+	 * When the last request was submitted.
+	 */
+	time_t last_request;
+
+	int poll_index;
+};
+
+/**
+ * An mpc process (or any other MPD client) connected to the proxy.
+ */
+struct client {
+	struct client *next;
+
+	int fd;
+
+	bool dead;
+
+	/**
+	 * Close the client after the output has been sent.
+	 */
+	bool closing;
+
+	struct fifo input, output;
+
+	/**
+	 * The connection which has this client's request in flight,
+	 * or NULL.  There is only one request per client in flight,
+	 * because requests on different connections may be answered
+	 * in any order.
+	 */
+	struct upstream *busy;
+
+	/**
+	 * A connection used only by this client, or NULL.
+	 */
+	struct upstream *dedicated;
+
+	/**
+	 * The "tagtypes" commands this client has sent since
+	 * "tagtypes all" (empty if it has never sent any).  They are
+	 * replayed on a shared connection before the client's next
+	 * request if that connection is in a different state.
+	 */
+	struct mpc_buffer tagtypes;
+
+	int poll_index;
+};
+
+struct proxy {
+	const struct proxy_settings *settings;
+
+	/**
+	 * The address of the MPD server, as resolved by the first
+	 * connection.
+	 */
+	struct sockaddr_storage address;
+	socklen_t address_length;
+
+	struct upstream *upstreams;
+	struct client *clients;
+
+	/**
+	 * The number of shared connections in #upstreams.
+	 */
+	unsigned n_shared;
+
+	/**
+	 * The greeting sent to new clients, with the version of the
+	 * MPD server.
+	 */
+	char greeting[64];
+
+	/**
+	 * The last error which occurred while connecting to MPD; it
+	 * is reported to the clients which need a new connection.
+	 */
+	char error[256];
+};
+
+/**
+ * Commands which change the state of the connection.  Clients
+ * sending them get a dedicated MPD connection, so they don't disturb
+ * other clients.  "tagtypes" is not among them, because every mpc
+ * command which prints songs sends it; shared connections replay it
+ * for each client instead (see #client::tagtypes).
+ */
+static const char *const stateful_commands[] = {
+	"idle",
+	"partition",
+	"password",
+	"binarylimit",
+	"protocol",
+	"subscribe",
+	"unsubscribe",
+	"readmessages",
+	NULL
+};
+
+static volatile sig_atomic_t proxy_quit;
+
+/**
+ * Does the line start with the given command name?
+ */
+gcc_pure
+static bool
+command_is(const char *line, const char *eol, const char *name)
+{
+	const size_t length = strlen(name);
+	return (size_t)(eol - line) >= length &&
+		memcmp(line, name, length) == 0 &&
+		(line + length == eol || line[length] == ' ');
+}
+
+/**
+ * Does the (only) argument of the command on this line equal the
+ * given value?  The argument may be quoted like libmpdclient does.
+ */
+gcc_pure
+static bool
+argument_equals(const char *line, const char *eol, const char *value)
+{
+	const char *p = memchr(line, ' ', eol - line);
+	if (p == NULL)
+		return false;
+
+	++p;
+
+	if (*p != '"')
+		return (size_t)(eol - p) == strlen(value) &&
+			memcmp(p, value, eol - p) == 0;
+
+	for (++p; p < eol; ++p) {
+		if (*p == '"')
+			return *value == 0 && p + 1 == eol;
+
+		if (*p == '\\' && p + 1 < eol)
+			++p;
+
+		if (*p != *value++)
+			return false;
+	}
+
+	return false;
+}
+
+/**
+ * Determine the length of the first complete request in the buffer:
+ * one line, or a whole command list.
+ *
+ * @return the length including the final newline, or 0 if the
+ * request is incomplete
+ */
+gcc_pure
+static size_t
+request_length(const char *data, size_t size)
+{
+	const char *const end = data + size;
+	const char *eol = memchr(data, '\n', size);
+	if (eol == NULL)
+		return 0;
+
+	if (!command_is(data, eol, "command_list_begin") &&
+	    !command_is(data, eol, "command_list_ok_begin"))
+		return eol + 1 - data;
+
+	for (const char *line = eol + 1; line < end; line = eol + 1) {
+		eol = memchr(line, '\n', end - line);
+		if (eol == NULL)
+			break;
+
+		if (command_is(line, eol, "command_list_end"))
+			return eol + 1 - data;
+	}
+
+	return 0;
+}
+
+gcc_pure
+static bool
+is_stateful(const char *line, const char *eol)
+{
+	for (unsigned i = 0; stateful_commands[i] != NULL; ++i)
+		if (command_is(line, eol, stateful_commands[i]))
+			return true;
+
+	return false;
+}
+
+/**
+ * Can this command be answered with "OK" by the proxy itself,
+ * because the shared connections are in the requested state
+ * already?
+ */
+gcc_pure
+static bool
+is_redundant(const struct proxy_settings *settings,
+	     const char *line, const char *eol)
+{
+	if (command_is(line, eol, "password"))
+		return settings->password != NULL &&
+			argument_equals(line, eol, settings->password);
+
+	if (command_is(line, eol, "partition"))
+		return argument_equals(line, eol,
+				       settings->partition != NULL
+				       ? settings->partition
+				       : "default");
+
+	return false;
+}
+
+/**
+ * Does the request contain a command which requires a dedicated
+ * connection?  Redundant commands in a command list (e.g. the
+ * "password" which mpc sends before its first command) do not.
+ */
+gcc_pure
+static bool
+needs_dedicated(const struct proxy_settings *settings,
+		const char *request, size_t length)
+{
+	const char *const end = request + length;
+
+	for (const char *line = request; line < end;) {
+		const char *eol = memchr(line, '\n', end - line);
+		assert(eol != NULL);
+
+		if (is_stateful(line, eol) &&
+		    !is_redundant(settings, line, eol))
+			return true;
+
+		line = eol + 1;
+	}
+
+	return false;
+}
+
+/**
+ * Update the "tagtypes" state (see #client::tagtypes) with the
+ * "tagtypes" commands in the request.
+ */
+static void
+update_tagtypes(struct mpc_buffer *tagtypes,
+		const char *request, size_t length)
+{
+	const char *const end = request + length;
+
+	for (const char *line = request; line < end;) {
+		const char *eol = memchr(line, '\n', end - line);
+		assert(eol != NULL);
+
+		/* "tagtypes" without arguments is a query */
+		if (command_is(line, eol, "tagtypes") && line + 8 < eol) {
+			if (argument_equals(line, eol, "all") ||
+			    argument_equals(line, eol, "clear"))
+				mpc_buffer_clear(tagtypes);
+
+			if (!argument_equals(line, eol, "all"))
+				mpc_buffer_append(tagtypes, line,
+						  eol + 1 - line);
+		}
+
+		line = eol + 1;
+	}
+}
+
+static void
+client_error(struct proxy *proxy, struct client *c)
+{
+	char buffer[sizeof(proxy->error) + 32];
+	const int length = snprintf(buffer, sizeof(buffer),
+				    "ACK [5@0] {} proxy: %s\n",
+				    proxy->error);
+	fifo_append(&c->output, buffer, length);
+}
+
+static struct upstream *
+upstream_new(struct proxy *proxy, int fd, struct client *owner)
+{
+	struct upstream *u = malloc(sizeof(*u));
+	u->fd = fd;
+	u->connecting = false;
+	u->handshake = false;
+	u->n_setup = 0;
+	u->shared = owner == NULL;
+	u->dead = false;
+	u->owner = owner;
+	fifo_init(&u->output);
+	fifo_init(&u->input);
+	u->waiting = NULL;
+	u->n_waiting = u->max_waiting = 0;
+	u->binary_remaining = 0;
+	mpc_buffer_init(&u->tagtypes);
+	u->tagtypes_unknown = false;
+	u->last_request = time(NULL);
+	u->poll_index = -1;
+
+	u->next = proxy->upstreams;
+	proxy->upstreams = u;
+
+	if (u->shared)
+		++proxy->n_shared;
+
+	return u;
+}
+
+static void
+upstream_free(struct upstream *u)
+{
+	close(u->fd);
+	fifo_deinit(&u->output);
+	fifo_deinit(&u->input);
+	free(u->waiting);
+	mpc_buffer_deinit(&u->tagtypes);
+	free(u);
+}
+
+static void
+upstream_push_waiting(struct upstream *u, struct client *c)
+{
+	if (u->n_waiting == u->max_waiting) {
+		u->max_waiting = u->max_waiting > 0 ? u->max_waiting * 2 : 8;
+		u->waiting = realloc(u->waiting,
+				     u->max_waiting * sizeof(*u->waiting));
+	}
+
+	u->waiting[u->n_waiting++] = c;
+}
+
+/**
+ * Connect to MPD synchronously, before accepting clients: this fails
+ * early, and it tells the server version for the greeting and the
+ * address for all further connections.
+ */
+static bool
+proxy_connect(struct proxy *proxy)
+{
+	const struct proxy_settings *settings = proxy->settings;
+
+	struct mpd_connection *connection =
+		mpd_connection_new(settings->host, settings->port, 0);
+	if (connection == NULL) {
+		fprintf(stderr, "proxy: Out of memory\n");
+		return false;
+	}
+
+	if (mpd_connection_get_error(connection) != MPD_ERROR_SUCCESS ||
+	    (settings->password != NULL &&
+	     !mpd_run_password(connection, settings->password)) ||
+	    (settings->partition != NULL &&
+	     !mpd_run_switch_partition(connection, settings->partition))) {
+		fprintf(stderr, "proxy: %s\n",
+			mpd_connection_get_error_message(connection));
+		mpd_connection_free(connection);
+		return false;
+	}
+
+	const unsigned *version =
+		mpd_connection_get_server_version(connection);
+	snprintf(proxy->greeting, sizeof(proxy->greeting),
+		 "OK MPD %u.%u.%u\n",
+		 version[0], version[1], version[2]);
+
+	/* keep the socket as the first shared connection */
+	const int fd = mpd_connection_get_fd(connection);
+	proxy->address_length = sizeof(proxy->address);
+	const int new_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if (getpeername(fd, (struct sockaddr *)&proxy->address,
+			&proxy->address_length) < 0 || new_fd < 0) {
+		perror("proxy");
+		if (new_fd >= 0)
+			close(new_fd);
+		mpd_connection_free(connection);
+		return false;
+	}
+
+	mpd_connection_free(connection);
+	upstream_new(proxy, new_fd, NULL);
+	return true;
+}
+
+/**
+ * Start connecting to MPD without blocking.  The commands which set
+ * up the connection are queued; the greeting and their responses are
+ * handled by upstream_process_input().
+ *
+ * @return NULL on error (after setting #proxy::error)
+ */
+static struct upstream *
+upstream_open(struct proxy *proxy, struct client *owner)
+{
+	const struct proxy_settings *settings = proxy->settings;
+
+	const int fd = socket(proxy->address.ss_family,
+			      SOCK_STREAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		snprintf(proxy->error, sizeof(proxy->error),
+			 "Failed to create socket: %s", strerror(errno));
+		return NULL;
+	}
+
+	bool connecting = false;
+	if (connect(fd, (const struct sockaddr *)&proxy->address,
+		    proxy->address_length) < 0) {
+		if (errno != EINPROGRESS) {
+			snprintf(proxy->error, sizeof(proxy->error),
+				 "Failed to connect to MPD: %s",
+				 strerror(errno));
+			fprintf(stderr, "proxy: %s\n", proxy->error);
+			close(fd);
+			return NULL;
+		}
+
+		connecting = true;
+	}
+
+	struct upstream *u = upstream_new(proxy, fd, owner);
+	u->connecting = connecting;
+	u->handshake = true;
+
+	if (settings->password != NULL) {
+		fifo_append_command(&u->output, "password",
+				    settings->password);
+		upstream_push_waiting(u, NULL);
+		++u->n_setup;
+	}
+
+	if (settings->partition != NULL) {
+		fifo_append_command(&u->output, "partition",
+				    settings->partition);
+		upstream_push_waiting(u, NULL);
+		++u->n_setup;
+	}
+
+	return u;
+}
+
+static void
+client_process_input(struct proxy *proxy, struct client *c);
+
+/**
+ * Setting up the connection to MPD has failed: answer the requests
+ * waiting for it with #proxy::error.  No state of the clients was
+ * lost, so they may continue.
+ */
+static void
+upstream_abort(struct proxy *proxy, struct upstream *u)
+{
+	fprintf(stderr, "proxy: %s\n", proxy->error);
+
+	u->dead = true;
+
+	if (u->owner != NULL) {
+		u->owner->dedicated = NULL;
+		u->owner = NULL;
+	}
+
+	const unsigned n_waiting = u->n_waiting;
+	u->n_waiting = 0;
+
+	for (unsigned i = 0; i < n_waiting; ++i) {
+		struct client *c = u->waiting[i];
+		if (c != NULL) {
+			c->busy = NULL;
+			client_error(proxy, c);
+		}
+	}
+
+	for (unsigned i = 0; i < n_waiting; ++i)
+		if (u->waiting[i] != NULL)
+			client_process_input(proxy, u->waiting[i]);
+}
+
+/**
+ * The connection to MPD is broken: disconnect all clients which wait
+ * for it, because their requests are lost.
+ */
+static void
+upstream_fail(struct proxy *proxy, struct upstream *u)
+{
+	if (u->connecting || u->handshake || u->n_setup > 0) {
+		snprintf(proxy->error, sizeof(proxy->error),
+			 "MPD closed the connection");
+		upstream_abort(proxy, u);
+		return;
+	}
+
+	u->dead = true;
+
+	for (unsigned i = 0; i < u->n_waiting; ++i) {
+		struct client *c = u->waiting[i];
+		if (c != NULL) {
+			c->busy = NULL;
+			c->dead = true;
+		}
+	}
+
+	u->n_waiting = 0;
+
+	if (u->owner != NULL)
+		u->owner->dead = true;
+}
+
+/**
+ * The non-blocking connect() has finished.
+ */
+static void
+upstream_connected(struct proxy *proxy, struct upstream *u)
+{
+	int error = 0;
+	socklen_t length = sizeof(error);
+	if (getsockopt(u->fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0)
+		error = errno;
+
+	if (error != 0) {
+		snprintf(proxy->error, sizeof(proxy->error),
+			 "Failed to connect to MPD: %s", strerror(error));
+		upstream_abort(proxy, u);
+		return;
+	}
+
+	u->connecting = false;
+}
+
+/**
+ * Append a request to the output of a shared connection, replacing
+ * redundant commands with "ping", which has the same (empty)
+ * response, but does not change the connection's state.
+ */
+static void
+append_shared_request(struct fifo *output,
+		      const struct proxy_settings *settings,
+		      const char *request, size_t length)
+{
+	const char *const end = request + length;
+
+	for (const char *line = request; line < end;) {
+		const char *eol = memchr(line, '\n', end - line);
+		assert(eol != NULL);
+
+		if (is_redundant(settings, line, eol))
+			fifo_append(output, "ping\n", 5);
+		else
+			fifo_append(output, line, eol + 1 - line);
+
+		line = eol + 1;
+	}
+}
+
+/**
+ * Bring a shared connection into the "tagtypes" state of the client.
+ * The response is discarded.
+ */
+static void
+upstream_apply_tagtypes(struct upstream *u, const struct client *c)
+{
+	if (!u->tagtypes_unknown && buffer_equals(&u->tagtypes, &c->tagtypes))
+		return;
+
+	static const char begin[] = "command_list_begin\ntagtypes all\n";
+	static const char end[] = "command_list_end\n";
+
+	fifo_append(&u->output, begin, sizeof(begin) - 1);
+	if (c->tagtypes.length > 0)
+		fifo_append(&u->output, c->tagtypes.data, c->tagtypes.length);
+	fifo_append(&u->output, end, sizeof(end) - 1);
+	upstream_push_waiting(u, NULL);
+
+	u->tagtypes_unknown = false;
+}
+
+static void
+upstream_submit(struct upstream *u, struct client *c,
+		const struct proxy_settings *settings,
+		const char *request, size_t length)
+{
+	if (u->shared) {
+		if (c != NULL)
+			upstream_apply_tagtypes(u, c);
+
+		append_shared_request(&u->output, settings, request, length);
+	} else
+		fifo_append(&u->output, request, length);
+
+	upstream_push_waiting(u, c);
+	u->last_request = time(NULL);
+
+	if (c != NULL) {
+		c->busy = u;
+
+		update_tagtypes(&c->tagtypes, request, length);
+
+		if (u->shared) {
+			mpc_buffer_clear(&u->tagtypes);
+			if (c->tagtypes.length > 0)
+				mpc_buffer_append(&u->tagtypes,
+						  c->tagtypes.data,
+						  c->tagtypes.length);
+		}
+	}
+}
+
+/**
+ * Choose the shared connection for the next request: an unused one,
+ * a new one while the pool is not full, or else the one with the
+ * fewest pending requests.
+ */
+static struct upstream *
+upstream_choose(struct proxy *proxy)
+{
+	struct upstream *best = NULL;
+
+	for (struct upstream *u = proxy->upstreams; u != NULL; u = u->next)
+		if (u->shared && !u->dead &&
+		    (best == NULL || u->n_waiting < best->n_waiting))
+			best = u;
+
+	if ((best == NULL || best->n_waiting > 0) &&
+	    proxy->n_shared < proxy->settings->pool_size) {
+		struct upstream *u = upstream_open(proxy, NULL);
+		if (u != NULL)
+			return u;
+	}
+
+	return best;
+}
+
+/**
+ * The response to the oldest request is complete.
+ */
+static void
+upstream_pop(struct proxy *proxy, struct upstream *u)
+{
+	assert(u->n_waiting > 0);
+
+	struct client *c = u->waiting[0];
+	--u->n_waiting;
+	memmove(u->waiting, u->waiting + 1,
+		u->n_waiting * sizeof(*u->waiting));
+
+	if (c != NULL) {
+		c->busy = NULL;
+
+		/* submit the client's next request */
+		client_process_input(proxy, c);
+	}
+}
+
+static void
+upstream_forward(struct upstream *u, const char *data, size_t length)
+{
+	struct client *c = u->waiting[0];
+	if (c != NULL)
+		fifo_append(&c->output, data, length);
+}
+
+/**
+ * Forward response data to the clients which are waiting for it.
+ */
+static void
+upstream_process_input(struct proxy *proxy, struct upstream *u)
+{
+	while (!u->dead && fifo_size(&u->input) > 0) {
+		const char *data = fifo_data(&u->input);
+		const size_t size = fifo_size(&u->input);
+
+		if (u->handshake) {
+			const char *eol = memchr(data, '\n', size);
+			if (eol == NULL)
+				break;
+
+			if (eol - data < 7 || memcmp(data, "OK MPD ", 7) != 0) {
+				snprintf(proxy->error, sizeof(proxy->error),
+					 "Malformed greeting from MPD");
+				upstream_abort(proxy, u);
+				break;
+			}
+
+			u->handshake = false;
+			fifo_consume(&u->input, eol + 1 - data);
+			continue;
+		}
+
+		if (u->n_waiting == 0) {
+			fprintf(stderr, "proxy: unexpected data from MPD\n");
+			upstream_fail(proxy, u);
+			break;
+		}
+
+		if (u->binary_remaining > 0) {
+			const size_t n = size < u->binary_remaining
+				? size : u->binary_remaining;
+			upstream_forward(u, data, n);
+			fifo_consume(&u->input, n);
+			u->binary_remaining -= n;
+			continue;
+		}
+
+		const char *eol = memchr(data, '\n', size);
+		if (eol == NULL)
+			break;
+
+		const size_t length = eol + 1 - data;
+		upstream_forward(u, data, length);
+
+		const bool ack = length > 4 && memcmp(data, "ACK ", 4) == 0;
+		bool done = ack;
+		if (length > 8 && memcmp(data, "binary: ", 8) == 0)
+			u->binary_remaining =
+				strtoull(data + 8, NULL, 10) + 1;
+		else if (length == 3 && memcmp(data, "OK\n", 3) == 0)
+			done = true;
+
+		if (ack && u->n_setup > 0) {
+			/* the message follows the command name */
+			const char *message = memchr(data, '}', length);
+			message = message != NULL ? message + 1 : data;
+			while (*message == ' ')
+				++message;
+
+			snprintf(proxy->error, sizeof(proxy->error), "%.*s",
+				 (int)(eol - message), message);
+			upstream_abort(proxy, u);
+			break;
+		}
+
+		if (ack)
+			/* MPD skipped the rest of the request, which
+			   may have contained "tagtypes" */
+			u->tagtypes_unknown = true;
+
+		fifo_consume(&u->input, length);
+
+		if (done) {
+			if (u->n_setup > 0)
+				--u->n_setup;
+
+			upstream_pop(proxy, u);
+		}
+	}
+}
+
+gcc_pure
+static bool
+upstream_is_congested(const struct upstream *u)
+{
+	return u->n_waiting > 0 && u->waiting[0] != NULL &&
+		fifo_size(&u->waiting[0]->output) >= MAX_BACKLOG;
+}
+
+static void
+proxy_accept(struct proxy *proxy, int listen_fd)
+{
+	const int fd = accept4(listen_fd, NULL, NULL,
+			       SOCK_CLOEXEC|SOCK_NONBLOCK);
+	if (fd < 0)
+		return;
+
+	struct client *c = malloc(sizeof(*c));
+	c->fd = fd;
+	c->dead = false;
+	c->closing = false;
+	fifo_init(&c->input);
+	fifo_init(&c->output);
+	c->busy = NULL;
+	c->dedicated = NULL;
+	mpc_buffer_init(&c->tagtypes);
+	c->poll_index = -1;
+
+	fifo_append(&c->output, proxy->greeting, strlen(proxy->greeting));
+
+	c->next = proxy->clients;
+	proxy->clients = c;
+}
+
+static void
+client_free(struct client *c)
+{
+	if (c->busy != NULL) {
+		/* discard the response */
+		struct upstream *u = c->busy;
+		for (unsigned i = 0; i < u->n_waiting; ++i)
+			if (u->waiting[i] == c)
+				u->waiting[i] = NULL;
+	}
+
+	if (c->dedicated != NULL) {
+		c->dedicated->owner = NULL;
+		c->dedicated->dead = true;
+	}
+
+	close(c->fd);
+	fifo_deinit(&c->input);
+	fifo_deinit(&c->output);
+	mpc_buffer_deinit(&c->tagtypes);
+	free(c);
+}
+
+static void
+client_handle_request(struct proxy *proxy, struct client *c,
+		      const char *request, size_t length)
+{
+	const char *eol = memchr(request, '\n', length);
+	assert(eol != NULL);
+
+	if (command_is(request, eol, "close")) {
+		c->closing = true;
+		return;
+	}
+
+	if (command_is(request, eol, "noidle"))
+		/* not idle; MPD ignores this, too */
+		return;
+
+	struct upstream *u = c->dedicated;
+	if (u == NULL) {
+		if (eol + 1 == request + length &&
+		    is_redundant(proxy->settings, request, eol)) {
+			fifo_append(&c->output, "OK\n", 3);
+			return;
+		}
+
+		u = needs_dedicated(proxy->settings, request, length)
+			? (c->dedicated = upstream_open(proxy, c))
+			: upstream_choose(proxy);
+
+		if (u == NULL) {
+			client_error(proxy, c);
+			return;
+		}
+	}
+
+	upstream_submit(u, c, proxy->settings, request, length);
+}
+
+/**
+ * Submit the client's next request, unless another one is in
+ * flight.
+ */
+static void
+client_process_input(struct proxy *proxy, struct client *c)
+{
+	while (!c->dead && !c->closing && fifo_size(&c->input) > 0) {
+		const char *data = fifo_data(&c->input);
+		const size_t size = fifo_size(&c->input);
+
+		if (c->busy != NULL) {
+			/* only "noidle" may interrupt a pending
+			   "idle" */
+			if (c->busy == c->dedicated && size >= 7 &&
+			    memcmp(data, "noidle\n", 7) == 0) {
+				fifo_append(&c->busy->output, data, 7);
+				fifo_consume(&c->input, 7);
+				continue;
+			}
+
+			break;
+		}
+
+		const size_t length = request_length(data, size);
+		if (length == 0) {
+			if (size > MAX_REQUEST)
+				c->dead = true;
+			break;
+		}
+
+		client_handle_request(proxy, c, data, length);
+		fifo_consume(&c->input, length);
+	}
+}
+
+/**
+ * Send pending output, send keepalive pings and free dead objects.
+ */
+static void
+proxy_flush(struct proxy *proxy)
+{
+	const time_t now = time(NULL);
+
+	for (struct upstream *u = proxy->upstreams; u != NULL; u = u->next) {
+		if (u->dead || u->connecting)
+			continue;
+
+		if (u->shared && u->n_waiting == 0 &&
+		    now - u->last_request >= KEEPALIVE_INTERVAL)
+			upstream_submit(u, NULL, proxy->settings,
+					"ping\n", 5);
+
+		if (!fifo_send(&u->output, u->fd))
+			upstream_fail(proxy, u);
+	}
+
+	for (struct client *c = proxy->clients; c != NULL; c = c->next) {
+		if (c->dead)
+			continue;
+
+		if (!fifo_send(&c->output, c->fd) ||
+		    (c->closing && fifo_size(&c->output) == 0))
+			c->dead = true;
+	}
+
+	/* free clients first, because this may kill their dedicated
+	   connections */
+
+	for (struct client **p = &proxy->clients; *p != NULL;) {
+		struct client *c = *p;
+		if (c->dead) {
+			*p = c->next;
+			client_free(c);
+		} else
+			p = &c->next;
+	}
+
+	for (struct upstream **p = &proxy->upstreams; *p != NULL;) {
+		struct upstream *u = *p;
+		if (u->dead) {
+			if (u->owner != NULL)
+				u->owner->dedicated = NULL;
+			if (u->shared)
+				--proxy->n_shared;
+
+			*p = u->next;
+			upstream_free(u);
+		} else
+			p = &u->next;
+	}
+}
+
+static void
+proxy_deinit(struct proxy *proxy)
+{
+	while (proxy->clients != NULL) {
+		struct client *c = proxy->clients;
+		proxy->clients = c->next;
+		c->busy = NULL;
+		c->dedicated = NULL;
+		client_free(c);
+	}
+
+	while (proxy->upstreams != NULL) {
+		struct upstream *u = proxy->upstreams;
+		proxy->upstreams = u->next;
+		upstream_free(u);
+	}
+}
+
+int
+proxy_listen(const char *path)
+{
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return -1;
+	}
+
+	strcpy(address.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("Failed to create socket");
+		return -1;
+	}
+
+	/* don't replace the socket of a running proxy */
+	if (connect(fd, (const struct sockaddr *)&address,
+		    sizeof(address)) == 0) {
+		fprintf(stderr, "%s is in use already\n", path);
+		close(fd);
+		return -1;
+	}
+
+	const bool stale = errno == ECONNREFUSED;
+	close(fd);
+
+	struct stat st;
+	if (stale && lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		perror("Failed to create socket");
+		return -1;
+	}
+
+	const mode_t old_umask = umask(0077);
+	const int result = bind(fd, (const struct sockaddr *)&address,
+				sizeof(address));
+	umask(old_umask);
+
+	if (result < 0 || listen(fd, 64) < 0) {
+		fprintf(stderr, "Failed to listen on %s: %s\n",
+			path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int
+proxy_run(int listen_fd, const struct proxy_settings *settings)
+{
+	struct proxy proxy = {
+		.settings = settings,
+	};
+
+	if (!proxy_connect(&proxy))
+		return -1;
+
+	struct pollfd *fds = NULL;
+	unsigned max_fds = 0;
+
+	proxy_quit = 0;
+
+	while (!proxy_quit) {
+		proxy_flush(&proxy);
+
+		unsigned n = 1;
+		for (struct upstream *u = proxy.upstreams; u != NULL; u = u->next)
+			++n;
+		for (struct client *c = proxy.clients; c != NULL; c = c->next)
+			++n;
+
+		if (n > max_fds) {
+			max_fds = n * 2;
+			fds = realloc(fds, max_fds * sizeof(*fds));
+		}
+
+		n = 0;
+		fds[n].fd = listen_fd;
+		fds[n].events = POLLIN;
+		++n;
+
+		for (struct upstream *u = proxy.upstreams; u != NULL; u = u->next) {
+			u->poll_index = n;
+			fds[n].fd = u->fd;
+			fds[n].events = u->connecting ? POLLOUT
+				: upstream_is_congested(u) ? 0 : POLLIN;
+			if (fifo_size(&u->output) > 0)
+				fds[n].events |= POLLOUT;
+			++n;
+		}
+
+		for (struct client *c = proxy.clients; c != NULL; c = c->next) {
+			c->poll_index = n;
+			fds[n].fd = c->fd;
+			fds[n].events = POLLIN;
+			if (fifo_size(&c->output) > 0)
+				fds[n].events |= POLLOUT;
+			++n;
+		}
+
+		if (poll(fds, n, KEEPALIVE_INTERVAL * 1000) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			perror("poll() failed");
+			break;
+		}
+
+		for (struct upstream *u = proxy.upstreams; u != NULL; u = u->next) {
+			if (u->dead || u->poll_index < 0)
+				continue;
+
+			const short revents = fds[u->poll_index].revents;
+			if (u->connecting) {
+				if (revents != 0)
+					upstream_connected(&proxy, u);
+				continue;
+			}
+
+			if ((revents & (POLLIN|POLLHUP|POLLERR)) == 0)
+				continue;
+
+			if (fifo_receive(&u->input, u->fd))
+				upstream_process_input(&proxy, u);
+			else
+				upstream_fail(&proxy, u);
+		}
+
+		for (struct client *c = proxy.clients; c != NULL; c = c->next) {
+			if (c->dead || c->poll_index < 0 ||
+			    (fds[c->poll_index].revents & (POLLIN|POLLHUP|POLLERR)) == 0)
+				continue;
+
+			if (fifo_receive(&c->input, c->fd))
+				client_process_input(&proxy, c);
+			else
+				c->dead = true;
+		}
+
+		if (fds[0].revents & POLLIN)
+			proxy_accept(&proxy, listen_fd);
+	}
+
+	free(fds);
+	proxy_deinit(&proxy);
+	return 0;
+}
+
+void
+proxy_stop(void)
+{
+	proxy_quit = 1;
+}
+
+static void
+proxy_signal_handler(gcc_unused int signo)
+{
+	proxy_stop();
+}
+
+int
+cmd_proxy(gcc_unused int argc, gcc_unused char **argv,
+	  gcc_unused struct mpd_connection *conn)
+{
+	char buffer[PATH_MAX];
+	const char *path = options.listen;
+	if (path == NULL) {
+		const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+		if (runtime_dir == NULL) {
+			fprintf(stderr, "No socket path; use --listen\n");
+			return -1;
+		}
+
+		snprintf(buffer, sizeof(buffer), "%s/mpc.sock", runtime_dir);
+		path = buffer;
+	}
+
+	const int fd = proxy_listen(path);
+	if (fd < 0)
+		return -1;
+
+	struct sigaction sa = {
+		.sa_handler = proxy_signal_handler,
+	};
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	const struct proxy_settings settings = {
+		.host = options.host,
+		.port = options.port,
+		.password = options.password,
+		.partition = options.partition,
+		.pool_size = POOL_SIZE,
+	};
+
+	const int result = proxy_run(fd, &settings);
+
+	close(fd);
+	unlink(path);
+
+	return result < 0 ? -1 : 0;
+}
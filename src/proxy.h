@@ -0,0 +1,59 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef MPC_PROXY_H
+#define MPC_PROXY_H
+
+struct mpd_connection;
+
+/**
+ * How the proxy connects to MPD.
+ */
+struct proxy_settings {
+	/** see mpd_connection_new() */
+	const char *host;
+	unsigned port;
+
+	/** sent on each new MPD connection, or NULL */
+	const char *password;
+
+	/** switch each new MPD connection to this partition, or NULL */
+	const char *partition;
+
+	/** the maximum number of MPD connections shared by clients */
+	unsigned pool_size;
+};
+
+/**
+ * Create a listening Unix socket.  A stale socket file is replaced.
+ * The socket is accessible only by the current user.
+ *
+ * @return the socket descriptor, or -1 on error (after printing a
+ * message)
+ */
+int
+proxy_listen(const char *path);
+
+/**
+ * Accept clients on the listening socket and forward their requests
+ * to MPD.  Requests of different clients are pipelined onto a small
+ * pool of shared connections which are set up only once; clients
+ * which change the state of their connection (e.g. "idle") get a
+ * dedicated one.  Returns after proxy_stop() has been called.
+ *
+ * @return 0 on success, -1 if connecting to MPD initially failed
+ */
+int
+proxy_run(int listen_fd, const struct proxy_settings *settings);
+
+/**
+ * Make proxy_run() return.  This may be called from a signal
+ * handler.
+ */
+void
+proxy_stop(void);
+
+int
+cmd_proxy(int argc, char **argv, struct mpd_connection *conn);
+
+#endif
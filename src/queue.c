@@ -12,53 +12,77 @@
 
 #include <mpd/client.h>
 
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
-SIMPLE_CMD(cmd_clear, mpd_run_clear, 1)
-SIMPLE_CMD(cmd_shuffle, mpd_run_shuffle, 1)
+SIMPLE_CMD(cmd_clear, mpd_send_clear, 1)
+SIMPLE_CMD(cmd_shuffle, mpd_send_shuffle, 1)
 
-int
-cmd_add(int argc, char **argv, struct mpd_connection *conn)
+/**
+ * Send "add" for one argument.
+ */
+static bool
+send_add(struct mpd_connection *conn, char *arg)
+{
+	strip_trailing_slash(arg);
+
+	const char *path = arg;
+	const char *relative_path = to_relative_path(path);
+	if (relative_path != NULL)
+		path = relative_path;
+
+	if (options.verbosity >= V_VERBOSE)
+		printf("adding: %s\n", path);
+	return mpd_send_add(conn, charset_to_utf8(path));
+}
+
+/**
+ * Prepare to_relative_path() if one of the arguments is an absolute
+ * path.
+ */
+static void
+prepare_add(struct mpd_connection *conn, unsigned argc, char **argv)
 {
 	if (contains_absolute_path(argc, argv) && !path_prepare(conn))
 		printErrorAndExit(conn);
+}
 
-	if (!mpd_command_list_begin(conn, false))
-		printErrorAndExit(conn);
+int
+cmd_add(int argc, char **argv, struct mpd_connection *conn)
+{
+	if (is_stdin_argument(argc, argv)) {
+		send_stdin_lines(conn, "adding", prepare_add, send_add);
+		return 0;
+	}
 
-	for (int i = 0; i < argc; ++i) {
-		strip_trailing_slash(argv[i]);
+	if (contains_absolute_path(argc, argv)) {
+		deferred_flush(conn);
+		prepare_add(conn, argc, argv);
+	}
 
-		const char *path = argv[i];
-		const char *relative_path = to_relative_path(path);
-		if (relative_path != NULL)
-			path = relative_path;
+	deferred_list_begin(conn);
 
-		if (options.verbosity >= V_VERBOSE)
-			printf("adding: %s\n", path);
-		mpd_send_add(conn, charset_to_utf8(path));
-	}
+	for (int i = 0; i < argc; ++i)
+		send_add(conn, argv[i]);
 
-	if (!mpd_command_list_end(conn))
-		printErrorAndExit(conn);
+	if (deferred_active())
+		/* errors are reported by deferred_flush(), without
+		   the failed argument */
+		return 0;
 
-	if (!mpd_response_finish(conn)) {
-		if (mpd_connection_get_error(conn) == MPD_ERROR_SERVER) {
-			/* check which of the arguments has failed */
-			unsigned location =
-				mpd_connection_get_server_error_location(conn);
-			if (location < (unsigned)argc) {
-				/* we've got a valid location from the
-				   server */
-				const char *message =
-					mpd_connection_get_error_message(conn);
-				message = charset_from_utf8(message);
-				fprintf(stderr, "error adding %s: %s\n",
-					argv[location], message);
-				exit(EXIT_FAILURE);
-			}
+	unsigned location;
+	if (!deferred_list_commit(conn, &location)) {
+		/* check which of the arguments has failed */
+		if (location < (unsigned)argc) {
+			/* we've got a valid location from the server */
+			const char *message =
+				mpd_connection_get_error_message(conn);
+			message = charset_from_utf8(message);
+			fprintf(stderr, "error adding %s: %s\n",
+				argv[location], message);
+			abort_command(EXIT_FAILURE);
 		}
 
 		printErrorAndExit(conn);
@@ -67,29 +91,44 @@ cmd_add(int argc, char **argv, struct mpd_connection *conn)
 	return 0;
 }
 
+/**
+ * Send a "delete" for the positions START..END-1.
+ */
+static void
+send_delete_range(struct mpd_connection *conn, unsigned start, unsigned end)
+{
+	const bool success = end - start == 1
+		? mpd_send_delete(conn, start)
+		: mpd_send_delete_range(conn, start, end);
+	if (!success)
+		printErrorAndExit(conn);
+}
+
 int
 cmd_crop(gcc_unused int argc, gcc_unused char **argv,
 	 struct mpd_connection *conn)
 {
 	struct mpd_status *status = getStatus(conn);
-	int length = mpd_status_get_queue_length(status) - 1;
+	const unsigned length = mpd_status_get_queue_length(status);
 
-	if (length < 0) {
+	if (length == 0) {
 		mpd_status_free(status);
 		DIE("A playlist longer than 1 song in length is required to crop.\n");
 	} else if (mpd_status_get_state(status) == MPD_STATE_PLAY ||
 		   mpd_status_get_state(status) == MPD_STATE_PAUSE) {
-		if (!mpd_command_list_begin(conn, false))
-			printErrorAndExit(conn);
+		const unsigned current = mpd_status_get_song_pos(status);
+		mpd_status_free(status);
 
-		for (; length >= 0; --length)
-			if (length != mpd_status_get_song_pos(status))
-				mpd_send_delete(conn, length);
+		deferred_list_begin(conn);
 
-		mpd_status_free(status);
+		/* the songs after the current one first, so its
+		   position stays valid */
+		if (current + 1 < length)
+			send_delete_range(conn, current + 1, length);
+		if (current > 0)
+			send_delete_range(conn, 0, current);
 
-		mpd_command_list_end(conn);
-		my_finishCommand(conn);
+		deferred_list_end(conn);
 		return 0;
 	} else {
 		mpd_status_free(status);
@@ -97,99 +136,266 @@ cmd_crop(gcc_unused int argc, gcc_unused char **argv,
 	}
 }
 
+/**
+ * The songs selected by the arguments of "del".
+ */
+struct del_selection {
+	const struct mpd_status *status;
+
+	/** a flag for each queue position */
+	bool *positions;
+	unsigned length;
+
+	/** song ids, which are resolved to positions by
+	    del_resolve_ids() */
+	unsigned *ids;
+	unsigned n_ids, max_ids;
+};
+
+/**
+ * Add the songs specified by one argument of "del" to the selection.
+ *
+ * @return 0 on success, -1 on error (after printing a message)
+ */
+static int
+del_select(struct del_selection *selection, const char *s)
+{
+	const struct mpd_status *status = selection->status;
+
+	if (strncmp(s, "id:", 3) == 0) {
+		/* a song id */
+		char *endptr;
+		const unsigned long id = strtoul(s + 3, &endptr, 10);
+		if (endptr == s + 3 || *endptr != 0 || s[3] == '-' ||
+		    id > UINT_MAX)
+			DIE("error parsing song id from: %s\n", s);
+
+		if (selection->n_ids == selection->max_ids) {
+			selection->max_ids = selection->max_ids > 0
+				? selection->max_ids * 2 : 16;
+			selection->ids = realloc(selection->ids,
+						 selection->max_ids *
+						 sizeof(*selection->ids));
+		}
+
+		selection->ids[selection->n_ids++] = id;
+		return 0;
+	}
+
+	char *t;
+	int range[2];
+	range[0] = strtol(s, &t, 10);
+
+	/* If argument is 0 current song and we're not stopped */
+	if (range[0] == 0 && strlen(s) == 1 &&
+	    (mpd_status_get_state(status) == MPD_STATE_PLAY ||
+	     mpd_status_get_state(status) == MPD_STATE_PAUSE))
+		range[0] = mpd_status_get_song_pos(status) + 1;
+
+	if (s==t)
+		DIE("error parsing song numbers from: %s\n", s);
+	else if (*t=='-') {
+		char *t2;
+		range[1] = strtol(t+1, &t2, 10);
+		if(t + 1 == t2 || *t2!='\0')
+			DIE("error parsing range from: %s\n", s);
+	} else if (*t=='\0')
+		range[1] = range[0];
+	else
+		DIE("error parsing song numbers from: %s\n", s);
+
+	if (range[0] <= 0 || range[1] <= 0) {
+		if (range[0] == range[1])
+			DIE("song number must be positive: %i\n",
+			    range[0]);
+		else
+			DIE("song numbers must be positive: %i to %i\n",
+			    range[0], range[1]);
+	}
+
+	if (range[1] < range[0])
+		DIE("song range must be from low to high: %i to %i\n",range[0],range[1]);
+
+	if ((unsigned)range[1] > selection->length)
+		DIE("song number does not exist: %i\n",range[1]);
+
+	memset(selection->positions + range[0] - 1, true,
+	       range[1] - range[0] + 1);
+	return 0;
+}
+
+/**
+ * Select the songs specified by the lines on stdin.  They are parsed
+ * one chunk at a time, so only the selection is kept in memory.
+ */
+static int
+del_select_stdin(struct del_selection *selection)
+{
+	struct line_reader reader;
+	line_reader_init(&reader, stdin);
+
+	struct line_chunk chunk;
+	line_chunk_init(&chunk);
+
+	int ret = 0;
+	while (ret == 0 && line_reader_read(&reader, &chunk) > 0)
+		for (unsigned i = 0; ret == 0 && i < chunk.n_lines; ++i)
+			ret = del_select(selection, chunk.lines[i]);
+
+	line_chunk_deinit(&chunk);
+	line_reader_deinit(&reader);
+	return ret;
+}
+
+/**
+ * Look up the positions of the selected song ids (in one round trip)
+ * and select them, too.  A song selected both by its id and by its
+ * position, or by the same id twice, is then deleted only once.
+ *
+ * @return 0 on success, -1 on error (after printing a message)
+ */
+static int
+del_resolve_ids(struct mpd_connection *conn, struct del_selection *selection)
+{
+	if (!mpd_command_list_begin(conn, true))
+		printErrorAndExit(conn);
+
+	for (unsigned i = 0; i < selection->n_ids; ++i)
+		if (!mpd_send_get_queue_song_id(conn, selection->ids[i]))
+			printErrorAndExit(conn);
+
+	if (!mpd_command_list_end(conn))
+		printErrorAndExit(conn);
+
+	int ret = 0;
+	for (unsigned i = 0; i < selection->n_ids; ++i) {
+		struct mpd_song *song = mpd_recv_song(conn);
+		if (song == NULL)
+			printErrorAndExit(conn);
+
+		const unsigned position = mpd_song_get_pos(song);
+		mpd_song_free(song);
+
+		if (position < selection->length)
+			selection->positions[position] = true;
+		else
+			/* the queue has grown since "status" */
+			ret = -1;
+
+		if (!mpd_response_next(conn))
+			printErrorAndExit(conn);
+	}
+
+	my_finishCommand(conn);
+
+	if (ret != 0)
+		fprintf(stderr, "The queue has changed\n");
+
+	return ret;
+}
+
 int
 cmd_del(int argc, char **argv, struct mpd_connection *conn)
 {
 	struct mpd_status *status = getStatus(conn);
 
-	const unsigned plLength = mpd_status_get_queue_length(status);
-
-	bool *songsToDel = malloc(plLength);
-	memset(songsToDel, false, plLength);
-
-	for (unsigned i = 0; i < (unsigned)argc; ++i) {
-		const char *const s = argv[i];
-
-		char *t;
-		int range[2];
-		range[0] = strtol(s, &t, 10);
-
-		/* If argument is 0 current song and we're not stopped */
-		if (range[0] == 0 && strlen(s) == 1 &&
-		    (mpd_status_get_state(status) == MPD_STATE_PLAY ||
-		     mpd_status_get_state(status) == MPD_STATE_PAUSE))
-			range[0] = mpd_status_get_song_pos(status) + 1;
-
-		if (s==t)
-			DIE("error parsing song numbers from: %s\n", argv[i]);
-		else if (*t=='-') {
-			char *t2;
-			range[1] = strtol(t+1, &t2, 10);
-			if(t + 1 == t2 || *t2!='\0')
-				DIE("error parsing range from: %s\n", argv[i]);
-		} else if (*t=='\0')
-			range[1] = range[0];
-		else
-			DIE("error parsing song numbers from: %s\n", argv[i]);
-
-		if (range[0] <= 0 || range[1] <= 0) {
-			if (range[0] == range[1])
-				DIE("song number must be positive: %i\n",
-				    range[0]);
-			else
-				DIE("song numbers must be positive: %i to %i\n",
-				    range[0], range[1]);
-		}
+	struct del_selection selection = {
+		.status = status,
+		.length = mpd_status_get_queue_length(status),
+	};
+
+	selection.positions = malloc(selection.length);
+	memset(selection.positions, false, selection.length);
+
+	int ret = 0;
+	if (is_stdin_argument(argc, argv))
+		ret = del_select_stdin(&selection);
+	else
+		for (int i = 0; ret == 0 && i < argc; ++i)
+			ret = del_select(&selection, argv[i]);
+
+	mpd_status_free(status);
 
-		if (range[1] < range[0])
-			DIE("song range must be from low to high: %i to %i\n",range[0],range[1]);
+	if (ret == 0 && selection.n_ids > 0)
+		ret = del_resolve_ids(conn, &selection);
 
-		if ((unsigned)range[1] > plLength)
-			DIE("song number does not exist: %i\n",range[1]);
+	free(selection.ids);
 
-		memset(songsToDel + range[0] - 1, true, range[1] - range[0] + 1);
+	if (ret != 0) {
+		free(selection.positions);
+		return ret;
 	}
 
-	if (!mpd_command_list_begin(conn, false))
-		printErrorAndExit(conn);
+	deferred_list_begin(conn);
 
-	int songsDeleted = 0;
-	for (unsigned i = 0; i < plLength; ++i) {
-		if (songsToDel[i]) {
-			mpd_send_delete(conn, i - songsDeleted);
-			++songsDeleted;
+	/* delete each run of adjacent songs with one command, starting
+	   at the end of the queue, so the positions of the runs
+	   before it stay valid */
+	for (unsigned end = selection.length; end > 0;) {
+		if (!selection.positions[end - 1]) {
+			--end;
+			continue;
 		}
+
+		unsigned start = end - 1;
+		while (start > 0 && selection.positions[start - 1])
+			--start;
+
+		send_delete_range(conn, start, end);
+		end = start;
 	}
 
-	mpd_status_free(status);
-	free(songsToDel);
+	free(selection.positions);
 
-	mpd_command_list_end(conn);
-	my_finishCommand(conn);
+	deferred_list_end(conn);
 	return 0;
 }
 
-int
-cmd_playlist(int argc, char **argv, struct mpd_connection *conn)
+/**
+ * Send "playlistinfo" for one window of the queue (see
+ * print_song_pages()).
+ */
+static bool
+send_queue_window(struct mpd_connection *conn, unsigned start, unsigned end,
+		  bool first, gcc_unused void *ctx)
 {
+	if (!mpd_command_list_begin(conn, false))
+		return false;
+
 	/* ask MPD to omit the tags which are not used by the
 	   `--format` to reduce network transfer for tag values we're
 	   not going to use anyway */
+	if (first && !send_tag_types_for_format(conn, options.format))
+		return false;
+
+	const bool ret = start > 0 || end < UINT_MAX
+		? mpd_send_list_queue_range_meta(conn, start, end)
+		: mpd_send_list_queue_meta(conn);
+
+	return ret && mpd_command_list_end(conn);
+}
+
+int
+cmd_playlist(int argc, char **argv, struct mpd_connection *conn)
+{
+	if (argc == 0) {
+		print_song_pages(conn, send_queue_window, NULL, true);
+		return 0;
+	}
+
 	if (!mpd_command_list_begin(conn, false) ||
 	    !send_tag_types_for_format(conn, options.format))
 		printErrorAndExit(conn);
 
-	bool ret = argc > 0
-		? mpd_send_list_playlist_meta(conn, argv[0])
-		: mpd_send_list_queue_meta(conn);
-
-	if (ret == false)
+	/* MPD cannot send a part of a stored playlist (before 0.24),
+	   so "--range" is applied here */
+	if (!mpd_send_list_playlist_meta(conn, argv[0]))
 		printErrorAndExit(conn);
 
 	if (!mpd_command_list_end(conn))
 		printErrorAndExit(conn);
 
-	print_entity_list(conn, MPD_ENTITY_TYPE_SONG, true);
+	print_song_range(conn, true);
 	my_finishCommand(conn);
 	return 0;
 }
@@ -224,14 +430,20 @@ queue_range(struct mpd_connection *conn, unsigned start, unsigned end,
 		printErrorAndExit(conn);
 }
 
-int cmd_insert (int argc, char ** argv, struct mpd_connection *conn )
+/**
+ * Insert songs after the current one by appending them and moving
+ * them; this works with all MPD versions.
+ *
+ * @param status the status before the songs are added
+ */
+static int
+insert_append_move(int argc, char **argv, struct mpd_connection *conn,
+		   const struct mpd_status *status)
 {
-	struct mpd_status *status = getStatus(conn);
 	const unsigned from = mpd_status_get_queue_length(status);
 	const int cur_pos = mpd_status_get_song_pos(status);
 	const int next_id = mpd_status_get_next_song_id(status);
 	const bool random_mode = mpd_status_get_random(status);
-	mpd_status_free(status);
 
 	int ret = cmd_add(argc, argv, conn);
 	if (ret != 0)
@@ -256,6 +468,126 @@ int cmd_insert (int argc, char ** argv, struct mpd_connection *conn )
 	return 0;
 }
 
+#if LIBMPDCLIENT_CHECK_VERSION(2,20,0)
+
+/**
+ * Insert songs with "add URI +0" (MPD 0.23).  One command list
+ * contains "status", the "add" commands and another "status": the
+ * first one tells whether there is a current song at all, and both
+ * together how many songs were added.
+ */
+static int
+insert_relative(int argc, char **argv, struct mpd_connection *conn)
+{
+	prepare_add(conn, argc, argv);
+
+	const char **uris = malloc(argc * sizeof(*uris));
+	for (int i = 0; i < argc; ++i) {
+		strip_trailing_slash(argv[i]);
+
+		const char *relative_path = to_relative_path(argv[i]);
+		uris[i] = relative_path != NULL ? relative_path : argv[i];
+
+		if (options.verbosity >= V_VERBOSE)
+			printf("adding: %s\n", uris[i]);
+	}
+
+	if (!mpd_command_list_begin(conn, true) ||
+	    !mpd_send_status(conn))
+		printErrorAndExit(conn);
+
+	/* each song is inserted right after the current one, so
+	   sending them in reverse order keeps their order (even if an
+	   argument is a directory with several songs) */
+	for (int i = argc; i-- > 0;)
+		if (!mpd_send_add_whence(conn, charset_to_utf8(uris[i]), 0,
+					 MPD_POSITION_AFTER_CURRENT))
+			printErrorAndExit(conn);
+
+	free(uris);
+
+	if (!mpd_send_status(conn) || !mpd_command_list_end(conn))
+		printErrorAndExit(conn);
+
+	struct mpd_status *before = mpd_recv_status(conn);
+	if (before == NULL)
+		printErrorAndExit(conn);
+
+	/* skip the "list_OK" responses of the "add" commands */
+	struct mpd_pair *pair;
+	while ((pair = mpd_recv_pair(conn)) == NULL) {
+		if (mpd_response_next(conn))
+			continue;
+
+		if (mpd_connection_get_error(conn) != MPD_ERROR_SERVER)
+			printErrorAndExit(conn);
+
+		if (mpd_status_get_song_pos(before) < 0 &&
+		    mpd_connection_clear_error(conn)) {
+			/* there is no current song to insert after;
+			   the command list was aborted at the first
+			   "add" */
+			int ret = insert_append_move(argc, argv, conn,
+						     before);
+			mpd_status_free(before);
+			return ret;
+		}
+
+		/* command 0 is "status", the "add" commands are in
+		   reverse order */
+		const unsigned location =
+			mpd_connection_get_server_error_location(conn);
+		if (location >= 1 && location <= (unsigned)argc) {
+			const char *message =
+				mpd_connection_get_error_message(conn);
+			message = charset_from_utf8(message);
+			fprintf(stderr, "error adding %s: %s\n",
+				argv[argc - location], message);
+			abort_command(EXIT_FAILURE);
+		}
+
+		printErrorAndExit(conn);
+	}
+
+	mpd_enqueue_pair(conn, pair);
+
+	struct mpd_status *after = mpd_recv_status(conn);
+	if (after == NULL || !mpd_response_finish(conn))
+		printErrorAndExit(conn);
+
+	if (mpd_status_get_random(before)) {
+		/* let the new songs play next */
+		const unsigned start = mpd_status_get_song_pos(before) + 1;
+		const unsigned added = mpd_status_get_queue_length(after) -
+			mpd_status_get_queue_length(before);
+		if (added > 0)
+			queue_range(conn, start, start + added,
+				    mpd_status_get_next_song_id(before));
+	}
+
+	mpd_status_free(before);
+	mpd_status_free(after);
+	return 0;
+}
+
+#endif
+
+int cmd_insert (int argc, char ** argv, struct mpd_connection *conn )
+{
+#if LIBMPDCLIENT_CHECK_VERSION(2,20,0)
+	/* input from stdin is streamed by cmd_add(), so it cannot be
+	   reversed */
+	if (!is_stdin_argument(argc, argv) &&
+	    mpd_connection_cmp_server_version(conn, 0, 23, 0) >= 0)
+		return insert_relative(argc, argv, conn);
+#endif
+
+	struct mpd_status *status = getStatus(conn);
+	int ret = insert_append_move(argc, argv, conn, status);
+	mpd_status_free(status);
+	return ret;
+}
+
 
 int
 cmd_prio(int argc, char **argv, struct mpd_connection *conn)
@@ -269,26 +601,28 @@ cmd_prio(int argc, char **argv, struct mpd_connection *conn)
 	if (prio < 0 || prio > 255)
 		DIE("Priority must be between 0 and 255: %s\n", s);
 
-	if (!mpd_command_list_begin(conn, false))
-		printErrorAndExit(conn);
-
-	while (i < argc) {
-		s = argv[i++];
+	/* validate all positions before anything is sent, so a
+	   (possibly deferred) command list is never left half-done */
+	for (int j = i; j < argc; ++j) {
+		s = argv[j];
 		int position = strtol(s, &endptr, 10);
 		if (endptr == s || *endptr != 0)
 			DIE("Failed to parse number: %s\n", s);
 		if (position < 1)
 			DIE("Invalid song position: %s\n", s);
+	}
+
+	deferred_list_begin(conn);
 
+	while (i < argc) {
 		/* mpc's song positions are 1-based, but MPD uses
 		   0-based positions */
-		--position;
+		int position = strtol(argv[i++], NULL, 10) - 1;
 
 		if (!mpd_send_prio(conn, prio, position))
 			break;
 	}
 
-	mpd_command_list_end(conn);
-	my_finishCommand(conn);
+	deferred_list_end(conn);
 	return 0;
 }
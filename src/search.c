@@ -9,6 +9,7 @@
 #include "charset.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -123,31 +124,56 @@ add_constraints(int argc, char ** argv, struct mpd_connection *conn)
 	return true;
 }
 
-static int
-do_search(int argc, char ** argv, struct mpd_connection *conn, bool exact)
+struct search_request {
+	int argc;
+	char **argv;
+	bool exact;
+};
+
+/**
+ * Send the search for one window of the results (see
+ * print_song_pages()).
+ */
+static bool
+send_search_window(struct mpd_connection *conn, unsigned start, unsigned end,
+		   bool first, void *ctx)
 {
+	const struct search_request *request = ctx;
+
+	if (!mpd_command_list_begin(conn, false))
+		return false;
+
 	/* ask MPD to omit the tags which are not used by the
 	   `--format` to reduce network transfer for tag values we're
-	   not going to use anyway */
-	if (!mpd_command_list_begin(conn, false) ||
+	   not going to use anyway; this setting applies to all
+	   following windows */
+	if (first &&
 	    !send_tag_types_for_format(conn, options.custom_format ? options.format : NULL))
-		printErrorAndExit(conn);
-
-	mpd_search_db_songs(conn, exact);
-	if (!add_constraints(argc, argv, conn))
-		return -1;
-
-	if (!mpd_search_commit(conn))
-		printErrorAndExit(conn);
+		return false;
 
-	if (!mpd_command_list_end(conn))
-		printErrorAndExit(conn);
+	mpd_search_db_songs(conn, request->exact);
+	if (!add_constraints(request->argc, request->argv, conn))
+		return false;
 
-	print_entity_list(conn, MPD_ENTITY_TYPE_SONG, options.custom_format);
+	if ((start > 0 || end < UINT_MAX) &&
+	    !mpd_search_add_window(conn, start, end))
+		return false;
 
-	my_finishCommand(conn);
+	return mpd_search_commit(conn) && mpd_command_list_end(conn);
+}
 
-	return 0;
+static int
+do_search(int argc, char ** argv, struct mpd_connection *conn, bool exact)
+{
+	struct search_request request = {
+		.argc = argc,
+		.argv = argv,
+		.exact = exact,
+	};
+
+	return print_song_pages(conn, send_search_window, &request,
+				options.custom_format)
+		? 0 : -1;
 }
 
 static int
@@ -157,6 +183,11 @@ do_searchadd(int argc, char **argv, struct mpd_connection *conn, bool exact)
 	if (!add_constraints(argc, argv, conn))
 		return -1;
 
+	if (!range_is_full(&options.range) &&
+	    !mpd_search_add_window(conn, options.range.start,
+				   options.range.end))
+		printErrorAndExit(conn);
+
 	if (!mpd_search_commit(conn))
 		printErrorAndExit(conn);
 
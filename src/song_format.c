@@ -5,57 +5,57 @@
 #include "audio_format.h"
 #include "format.h"
 #include "charset.h"
+#include "buffer.h"
 
 #include <mpd/client.h>
 
+#include <assert.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
 /**
- * Append all tag entries of a given type into dest buffer.
+ * The string which separates multiple values of the same tag.
+ */
+static const char *tag_separator = ", ";
+
+/**
+ * Scratch buffer for joined multi-value tags.  It is reused for all
+ * songs, so it grows to fit the longest value and is not freed.
+ */
+static struct mpc_buffer tag_buffer;
+
+/**
+ * Join all values of the given tag.
  *
- * @param dest  Pointer to current write position in buffer
- * @param end   Pointer to the end of buffer (one past last byte)
- * @param song  MPD song object
- * @param tag   MPD tag type
- * @return      Updated dest pointer after writing; If text added, null-terminated.
- * If no tag of this type fund, returns NULL.
+ * @return the value (pointing into the song object if there is only
+ * one, or into #tag_buffer); NULL if the song does not have this tag
  */
-static char *
-copy_tags(char *dest, char *end, const struct mpd_song *song, enum mpd_tag_type tag)
+static const char *
+join_tags(const struct mpd_song *song, enum mpd_tag_type tag)
 {
 	const char *value = mpd_song_get_tag(song, tag, 0);
 	if (value == NULL)
 		return NULL;
 
-	// Get first tag separately, as it should not have a comma if it is the only entry.
-	int written = snprintf(dest, (size_t)(end - dest), "%s", value);
-	if (written < 0 || written >= (int)(end - dest))
-		return dest + (end - dest - 1); 
-	dest += written;
-
-	/* mpd_song_get_tag can be called repeatedly with different index
-	if tag has multiple entries (e.g. multiple artists)
-	It returns nullptr when it runs out. */
-	for (unsigned i = 1; ; ++i) {
-		value = mpd_song_get_tag(song, tag, i);
-		if (value == NULL)
-			break;
-
-		// need at least room for ", " + \0
-		if ((size_t)(end - dest) <= 2) 
-			break;
-		*dest++ = ',';
-		*dest++ = ' ';
-
-		written = snprintf(dest, (size_t)(end - dest), "%s", value);
-		if (written < 0 || written >= (int)(end - dest))
-			break;
-		dest += written;
+	const char *next = mpd_song_get_tag(song, tag, 1);
+	if (next == NULL)
+		/* only one value: no need to copy it */
+		return value;
+
+	const size_t separator_length = strlen(tag_separator);
+
+	mpc_buffer_clear(&tag_buffer);
+	mpc_buffer_append(&tag_buffer, value, strlen(value));
+
+	for (unsigned i = 2; next != NULL;
+	     next = mpd_song_get_tag(song, tag, i++)) {
+		mpc_buffer_append(&tag_buffer, tag_separator,
+				  separator_length);
+		mpc_buffer_append(&tag_buffer, next, strlen(next));
 	}
 
-	return dest;
+	return tag_buffer.data;
 }
 
 static const char *
@@ -77,27 +77,55 @@ format_mtime(char *buffer, size_t buffer_size,
 	return buffer;
 }
 
+static const struct {
+	const char *name;
+	enum song_attribute id;
+} song_attribute_names[] = {
+	{ "file", SONG_ATTRIBUTE_FILE },
+	{ "time", SONG_ATTRIBUTE_TIME },
+	{ "position", SONG_ATTRIBUTE_POSITION },
+	{ "id", SONG_ATTRIBUTE_ID },
+	{ "prio", SONG_ATTRIBUTE_PRIO },
+	{ "mtime", SONG_ATTRIBUTE_MTIME },
+	{ "mdate", SONG_ATTRIBUTE_MDATE },
+	{ "audioformat", SONG_ATTRIBUTE_AUDIOFORMAT },
+	{ .name = NULL }
+};
+
+static int
+song_resolve(const char *name)
+{
+	for (unsigned i = 0; song_attribute_names[i].name != NULL; ++i)
+		if (strcmp(name, song_attribute_names[i].name) == 0)
+			return song_attribute_names[i].id;
+
+	/* MPD_TAG_UNKNOWN is -1, which means "unknown attribute" */
+	return mpd_tag_name_iparse(name);
+}
+
 /**
  * Extract an attribute from a song object.
  *
  * @param song the song object
- * @param name the attribute name
- * @return the attribute value; NULL if the attribute name is invalid;
- * an empty string if the attribute name is valid, but not present in
- * the song
+ * @param id the attribute id returned by song_resolve()
+ * @return the attribute value; NULL if the attribute cannot be
+ * formatted; an empty string if the attribute is not present in the
+ * song
  */
 gcc_pure
 static const char *
-song_value(const struct mpd_song *song, const char *name)
+song_value(const struct mpd_song *song, int id)
 {
-	/* Arbitrary size.
-	Should be large enough to fit multiple artists with long names */
+	/* for numbers and dates; tag values are not copied here */
 	static char buffer[256];
 	const char *value;
 
-	if (strcmp(name, "file") == 0)
+	switch (id) {
+	case SONG_ATTRIBUTE_FILE:
 		value = mpd_song_get_uri(song);
-	else if (strcmp(name, "time") == 0) {
+		break;
+
+	case SONG_ATTRIBUTE_TIME: {
 		unsigned duration = mpd_song_get_duration(song);
 
 		if (duration > 0) {
@@ -106,39 +134,50 @@ song_value(const struct mpd_song *song, const char *name)
 			value = buffer;
 		} else
 			value = NULL;
-	} else if (strcmp(name, "position") == 0) {
+	}
+		break;
+
+	case SONG_ATTRIBUTE_POSITION: {
 		unsigned pos = mpd_song_get_pos(song);
 		snprintf(buffer, sizeof(buffer), "%u", pos+1);
 		value = buffer;
-	} else if (strcmp(name, "id") == 0) {
+	}
+		break;
+
+	case SONG_ATTRIBUTE_ID:
 		snprintf(buffer, sizeof(buffer), "%u", mpd_song_get_id(song));
 		value = buffer;
-	} else if (strcmp(name, "prio") == 0) {
+		break;
+
+	case SONG_ATTRIBUTE_PRIO:
 		snprintf(buffer, sizeof(buffer), "%u",
 			 mpd_song_get_prio(song));
 		value = buffer;
-	} else if (strcmp(name, "mtime") == 0) {
+		break;
+
+	case SONG_ATTRIBUTE_MTIME:
 		value = format_mtime(buffer, sizeof(buffer), song, "%c");
-	} else if (strcmp(name, "mdate") == 0) {
+		break;
+
+	case SONG_ATTRIBUTE_MDATE:
 		value = format_mtime(buffer, sizeof(buffer), song, "%x");
-	} else if (strcmp(name, "audioformat") == 0) {
+		break;
+
+	case SONG_ATTRIBUTE_AUDIOFORMAT: {
 		const struct mpd_audio_format *audio_format = mpd_song_get_audio_format(song);
 		if (audio_format == NULL)
 			return NULL;
 
 		format_audio_format(buffer, sizeof(buffer), audio_format);
 		value = buffer;
-	} else {
-		enum mpd_tag_type tag_type = mpd_tag_name_iparse(name);
-		if (tag_type == MPD_TAG_UNKNOWN)
-			return NULL;
+	}
+		break;
 
-		const char *added_text = copy_tags(buffer, buffer + sizeof(buffer), song, tag_type);
-		if (added_text != NULL) {
-			value = buffer;
-		}
-		else
-			value = NULL;
+	default:
+		assert(id >= 0 && id < MPD_TAG_COUNT);
+
+		value = join_tags(song, (enum mpd_tag_type)id);
+		break;
 	}
 
 	if (value != NULL)
@@ -150,13 +189,38 @@ song_value(const struct mpd_song *song, const char *name)
 }
 
 static const char *
-song_getter(const void *object, const char *name)
+song_getter(const void *object, int id)
 {
-	return song_value((const struct mpd_song *)object, name);
+	return song_value((const struct mpd_song *)object, id);
 }
 
+static const struct format_attributes song_attributes = {
+	.resolve = song_resolve,
+	.get = song_getter,
+};
+
 char *
 format_song(const struct mpd_song *song, const char *format)
 {
-	return format_object(format, song, song_getter);
+	return format_object(format, song, &song_attributes);
+}
+
+bool
+format_song_write(struct mpc_buffer *dest, const struct mpd_song *song,
+		  const char *format)
+{
+	return format_object_write(dest, format, song, &song_attributes);
+}
+
+void
+format_song_set_tag_separator(const char *separator)
+{
+	tag_separator = separator;
+}
+
+uint64_t
+format_song_attribute_mask(const char *format)
+{
+	return format_template_attribute_mask(format_template_get(format,
+								  &song_attributes));
 }
@@ -6,7 +6,28 @@
 
 #include "Compiler.h"
 
+#include <mpd/tag.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
 struct mpd_song;
+struct mpc_buffer;
+
+/**
+ * Song attributes which are not tags.  Tags use their enum
+ * mpd_tag_type value as attribute id.
+ */
+enum song_attribute {
+	SONG_ATTRIBUTE_FILE = MPD_TAG_COUNT,
+	SONG_ATTRIBUTE_TIME,
+	SONG_ATTRIBUTE_POSITION,
+	SONG_ATTRIBUTE_ID,
+	SONG_ATTRIBUTE_PRIO,
+	SONG_ATTRIBUTE_MTIME,
+	SONG_ATTRIBUTE_MDATE,
+	SONG_ATTRIBUTE_AUDIOFORMAT,
+};
 
 /**
  * Pretty-print song metadata into a string using the given format
@@ -22,4 +43,34 @@ char *
 format_song(const struct mpd_song *song,
 	    const char *format);
 
+/**
+ * Like format_song(), but append the result to a buffer which can be
+ * reused for many songs.
+ *
+ * @return true if output was produced, false if no format string
+ * group produced any output (the buffer is left unmodified then)
+ */
+bool
+format_song_write(struct mpc_buffer *dest, const struct mpd_song *song,
+		  const char *format);
+
+/**
+ * Set the string which is inserted between multiple values of the
+ * same tag (e.g. several artists).  The default is ", ".  The pointer
+ * must remain valid.
+ */
+void
+format_song_set_tag_separator(const char *separator);
+
+/**
+ * Determine which attributes are referenced by the format string,
+ * without formatting anything.  The result is cached together with
+ * the compiled format string.
+ *
+ * @return a bit mask; bit N is set if the attribute with the id N
+ * (an #mpd_tag_type or a #song_attribute) is referenced
+ */
+uint64_t
+format_song_attribute_mask(const char *format);
+
 #endif
@@ -27,39 +27,113 @@ elapsed_percent(const struct mpd_status *status)
 	return (elapsed * 100) / total;
 }
 
+enum status_attribute {
+	STATUS_ATTRIBUTE_TOTALTIME,
+	STATUS_ATTRIBUTE_SONGPOS,
+	STATUS_ATTRIBUTE_LENGTH,
+	STATUS_ATTRIBUTE_CURRENTTIMEMS,
+	STATUS_ATTRIBUTE_CURRENTTIME,
+	STATUS_ATTRIBUTE_PERCENTTIME,
+	STATUS_ATTRIBUTE_STATE,
+	STATUS_ATTRIBUTE_VOLUME,
+	STATUS_ATTRIBUTE_REPEAT,
+	STATUS_ATTRIBUTE_RANDOM,
+	STATUS_ATTRIBUTE_SINGLE,
+	STATUS_ATTRIBUTE_CONSUME,
+	STATUS_ATTRIBUTE_KBITRATE,
+	STATUS_ATTRIBUTE_AUDIOFORMAT,
+	STATUS_ATTRIBUTE_SAMPLERATE,
+	STATUS_ATTRIBUTE_BITS,
+	STATUS_ATTRIBUTE_CHANNELS,
+	STATUS_ATTRIBUTE_UPDATEID,
+};
+
+static const struct {
+	const char *name;
+	enum status_attribute id;
+} status_attribute_names[] = {
+	{ "totaltime", STATUS_ATTRIBUTE_TOTALTIME },
+	{ "songpos", STATUS_ATTRIBUTE_SONGPOS },
+	{ "length", STATUS_ATTRIBUTE_LENGTH },
+	{ "currenttimems", STATUS_ATTRIBUTE_CURRENTTIMEMS },
+	{ "currenttime", STATUS_ATTRIBUTE_CURRENTTIME },
+	{ "percenttime", STATUS_ATTRIBUTE_PERCENTTIME },
+	{ "state", STATUS_ATTRIBUTE_STATE },
+	{ "volume", STATUS_ATTRIBUTE_VOLUME },
+	{ "repeat", STATUS_ATTRIBUTE_REPEAT },
+	{ "random", STATUS_ATTRIBUTE_RANDOM },
+	{ "single", STATUS_ATTRIBUTE_SINGLE },
+	{ "consume", STATUS_ATTRIBUTE_CONSUME },
+	{ "kbitrate", STATUS_ATTRIBUTE_KBITRATE },
+	{ "audioformat", STATUS_ATTRIBUTE_AUDIOFORMAT },
+	{ "samplerate", STATUS_ATTRIBUTE_SAMPLERATE },
+	{ "bits", STATUS_ATTRIBUTE_BITS },
+	{ "channels", STATUS_ATTRIBUTE_CHANNELS },
+	{ "updateid", STATUS_ATTRIBUTE_UPDATEID },
+	{ .name = NULL }
+};
+
+static int
+status_resolve(const char *name)
+{
+	for (unsigned i = 0; status_attribute_names[i].name != NULL; ++i)
+		if (strcmp(name, status_attribute_names[i].name) == 0)
+			return status_attribute_names[i].id;
+
+	return -1;
+}
+
 /**
  * Extract an attribute from a status object
  *
  * @param status the status object
- * @param name the attribute name
- * @return the attribute value; NULL if the attribute name is invalid
+ * @param id the attribute id returned by status_resolve()
+ * @return the attribute value; NULL if the attribute is not available
  */
 gcc_pure
 static const char *
-status_value(const struct mpd_status *status, const char *name)
+status_value(const struct mpd_status *status, int id)
 {
 	static char buffer[40];
 
-	if (strcmp(name, "totaltime") == 0) {
+	switch ((enum status_attribute)id) {
+	case STATUS_ATTRIBUTE_TOTALTIME: {
 		unsigned duration = mpd_status_get_total_time(status);
 		snprintf(buffer, sizeof(buffer), "%u:%02u",
 			duration / 60, duration % 60);
-	} else if (strcmp(name, "songpos") == 0) {
+	}
+		break;
+
+	case STATUS_ATTRIBUTE_SONGPOS: {
 		int song_pos = mpd_status_get_song_pos(status) + 1;
 		snprintf(buffer, sizeof(buffer), "%i", song_pos);
-	} else if (strcmp(name, "length") == 0) {
+	}
+		break;
+
+	case STATUS_ATTRIBUTE_LENGTH: {
 		unsigned length = mpd_status_get_queue_length(status);
 		snprintf(buffer, sizeof(buffer), "%i", length);
-	} else if (strcmp(name, "currenttimems") == 0) {
+	}
+		break;
+
+	case STATUS_ATTRIBUTE_CURRENTTIMEMS: {
 		unsigned elapsed_ms = mpd_status_get_elapsed_ms(status);
 		snprintf(buffer, sizeof(buffer), "%u", elapsed_ms);
-	} else if (strcmp(name, "currenttime") == 0) {
+	}
+		break;
+
+	case STATUS_ATTRIBUTE_CURRENTTIME: {
 		unsigned elasped = mpd_status_get_elapsed_time(status);
 		snprintf(buffer, sizeof(buffer), "%u:%02u",
 			elasped / 60, elasped % 60);
-	} else if (strcmp(name, "percenttime") == 0) {
+	}
+		break;
+
+	case STATUS_ATTRIBUTE_PERCENTTIME:
 		sprintf(buffer, "%3u%c", elapsed_percent(status), '%');
-	} else if (strcmp(name, "state") == 0) {
+		break;
+
+	case STATUS_ATTRIBUTE_STATE:
 		if (mpd_status_get_state(status) == MPD_STATE_PLAY) {
 			return "playing";
 		} else if (mpd_status_get_state(status) == MPD_STATE_PAUSE) {
@@ -69,29 +143,37 @@ status_value(const struct mpd_status *status, const char *name)
 		} else {
 			return NULL;
 		}
-	} else if (strcmp(name, "volume") == 0) {
+
+	case STATUS_ATTRIBUTE_VOLUME:
 		sprintf(buffer, "%3i%c", mpd_status_get_volume(status), '%');
-	} else if (strcmp(name, "repeat") == 0) {
+		break;
+
+	case STATUS_ATTRIBUTE_REPEAT:
 		if (mpd_status_get_repeat(status)) {
 		    return "on";
 		} else {
 		    return "off";
 		}
-	} else if (strcmp(name, "random") == 0) {
+
+	case STATUS_ATTRIBUTE_RANDOM:
 		if (mpd_status_get_random(status)) {
 		    return "on";
 		} else {
 		    return "off";
 		}
-	} else if (strcmp(name, "single") == 0) {
+
+	case STATUS_ATTRIBUTE_SINGLE:
 		if (mpd_status_get_single_state(status) == MPD_SINGLE_ON) {
 			return "on";
 		} else if (mpd_status_get_single_state(status) == MPD_SINGLE_ONESHOT) {
 			return "once";
 		} else if (mpd_status_get_single_state(status) == MPD_SINGLE_OFF) {
 			return "off";
+		} else {
+			return NULL;
 		}
-	} else if (strcmp(name, "consume") == 0) {
+
+	case STATUS_ATTRIBUTE_CONSUME:
 #if LIBMPDCLIENT_CHECK_VERSION(2,21,0)
 		if (mpd_status_get_consume_state(status) == MPD_CONSUME_ON) {
 			return "on";
@@ -99,6 +181,8 @@ status_value(const struct mpd_status *status, const char *name)
 			return "once";
 		} else if (mpd_status_get_consume_state(status) == MPD_CONSUME_OFF) {
 			return "off";
+		} else {
+			return NULL;
 		}
 #else
 		if (mpd_status_get_consume(status)) {
@@ -107,23 +191,32 @@ status_value(const struct mpd_status *status, const char *name)
 		    return "off";
 		}
 #endif
-	} else if (strcmp(name, "kbitrate") == 0) {
+
+	case STATUS_ATTRIBUTE_KBITRATE:
 		sprintf(buffer, "%u", mpd_status_get_kbit_rate(status));
-	} else if (strcmp(name, "audioformat") == 0) {
+		break;
+
+	case STATUS_ATTRIBUTE_AUDIOFORMAT: {
 		const struct mpd_audio_format *af = mpd_status_get_audio_format(status);
 		if (af != NULL) {
 			format_audio_format(buffer, sizeof(buffer), af);
 		} else {
 			return NULL;
 		}
-	} else if (strcmp(name, "samplerate") == 0) {
+	}
+		break;
+
+	case STATUS_ATTRIBUTE_SAMPLERATE: {
 		const struct mpd_audio_format *af = mpd_status_get_audio_format(status);
 		if (af != NULL) {
 			sprintf(buffer, "%u", af->sample_rate);
 		} else {
 			return NULL;
 		}
-	} else if (strcmp(name, "bits") == 0) {
+	}
+		break;
+
+	case STATUS_ATTRIBUTE_BITS: {
 		const struct mpd_audio_format *af = mpd_status_get_audio_format(status);
 		if (af != NULL) {
 			if (af->bits == MPD_SAMPLE_FORMAT_FLOAT)
@@ -135,29 +228,45 @@ status_value(const struct mpd_status *status, const char *name)
 		} else {
 			return NULL;
 		}
-	} else if (strcmp(name, "channels") == 0) {
+	}
+		break;
+
+	case STATUS_ATTRIBUTE_CHANNELS: {
 		const struct mpd_audio_format *af = mpd_status_get_audio_format(status);
 		if (af != NULL) {
 			sprintf(buffer, "%u", af->channels);
 		} else {
 			return NULL;
 		}
-	} else if (strcmp(name, "updateid") == 0) {
+	}
+		break;
+
+	case STATUS_ATTRIBUTE_UPDATEID: {
 		unsigned update_id = mpd_status_get_update_id(status);
 		snprintf(buffer, sizeof(buffer), "%i", update_id);
 	}
-	else { return NULL; }
+		break;
+
+	default:
+		return NULL;
+	}
+
 	return buffer;
 }
 
 static const char *
-status_getter(const void *object, const char *name)
+status_getter(const void *object, int id)
 {
-	return status_value((const struct mpd_status *)object, name);
+	return status_value((const struct mpd_status *)object, id);
 }
 
+static const struct format_attributes status_attributes = {
+	.resolve = status_resolve,
+	.get = status_getter,
+};
+
 char *
 format_status(const struct mpd_status *status, const char *format)
 {
-	return format_object(format, status, status_getter);
+	return format_object(format, status, &status_attributes);
 }
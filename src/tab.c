@@ -4,6 +4,7 @@
 #include "tab.h"
 #include "charset.h"
 #include "util.h"
+#include "buffer.h"
 #include "Compiler.h"
 
 #include <mpd/client.h>
@@ -46,15 +47,19 @@ cmd_loadtab(gcc_unused int argc, char **argv, struct mpd_connection *conn)
 
 	tab_send_list(prefix, conn);
 
+	struct mpc_buffer buffer;
+	mpc_buffer_init(&buffer);
+
 	struct mpd_playlist *pl;
 	while ((pl = mpd_recv_playlist(conn)) != NULL) {
 		const char *path = mpd_playlist_get_path(pl);
 		if (memcmp(path, prefix, prefix_length) == 0)
-			printf("%s\n", charset_from_utf8(path));
+			print_utf8_line(&buffer, path);
 
 		mpd_playlist_free(pl);
 	}
 
+	mpc_buffer_deinit(&buffer);
 	my_finishCommand(conn);
 	return 0;
 }
@@ -69,15 +74,19 @@ cmd_lstab(gcc_unused int argc, char **argv, struct mpd_connection *conn)
 
 	tab_send_list(prefix, conn);
 
+	struct mpc_buffer buffer;
+	mpc_buffer_init(&buffer);
+
 	struct mpd_directory *dir;
 	while ((dir = mpd_recv_directory(conn)) != NULL) {
 		const char *path = mpd_directory_get_path(dir);
 		if (memcmp(path, prefix, prefix_length) == 0)
-			printf("%s\n", charset_from_utf8(path));
+			print_utf8_line(&buffer, path);
 
 		mpd_directory_free(dir);
 	}
 
+	mpc_buffer_deinit(&buffer);
 	my_finishCommand(conn);
 
 	return 0;
@@ -93,22 +102,30 @@ cmd_tab(gcc_unused int argc, char ** argv, struct mpd_connection *conn)
 
 	tab_send_list(prefix, conn);
 
+	struct mpc_buffer buffer;
+	mpc_buffer_init(&buffer);
+
 	struct mpd_entity *entity;
 	while ((entity = mpd_recv_entity(conn)) != NULL) {
 		const char entitytype = mpd_entity_get_type(entity);
 		if (entitytype == MPD_ENTITY_TYPE_DIRECTORY) {
 			const char *path = mpd_directory_get_path(mpd_entity_get_directory(entity));
-			if (memcmp(path, prefix, prefix_length) == 0)
-				printf("%s/\n", charset_from_utf8(path));
+			if (memcmp(path, prefix, prefix_length) == 0) {
+				mpc_buffer_clear(&buffer);
+				printf("%s/\n",
+				       charset_from_utf8_buffer(&buffer, path,
+								strlen(path)));
+			}
 		} else if (entitytype == MPD_ENTITY_TYPE_SONG) {
 			const char *path = mpd_song_get_uri(mpd_entity_get_song(entity));
 			if (memcmp(path, prefix, prefix_length) == 0)
-				printf("%s\n", charset_from_utf8(path));
+				print_utf8_line(&buffer, path);
 		}
 
 		mpd_entity_free(entity);
 	}
 
+	mpc_buffer_deinit(&buffer);
 	my_finishCommand(conn);
 	return 0;
 }
@@ -2,51 +2,58 @@
 // Copyright The Music Player Daemon Project
 
 #include "tags.h"
-#include "format.h"
+#include "song_format.h"
 
 #include <mpd/client.h>
 
 #include <stdint.h>
-#include <stdlib.h>
 
-static uint64_t tag_bits;
-
-static const char *
-collect_tags(gcc_unused const void *object, const char *name)
-{
-	enum mpd_tag_type tag_type = mpd_tag_name_iparse(name);
-	if (tag_type != MPD_TAG_UNKNOWN && tag_type < 64)
-		tag_bits |= (uint64_t)1 << (unsigned)tag_type;
-
-	return NULL;
-}
+static bool tag_types_modified;
 
 bool
 send_tag_types_for_format(struct mpd_connection *c,
 			  const char *format)
 {
+	tag_types_modified = true;
+
 	if (format == NULL)
 		return mpd_send_clear_tag_types(c);
 
-	/* use format_object() to fill the "tag_bits" mask */
-
-	tag_bits = 0;
-
-	char *result = format_object(format, NULL, collect_tags);
-	free(result);
+	const uint64_t mask = format_song_attribute_mask(format);
 
 	if (!mpd_send_clear_tag_types(c))
 		return false;
 
-	/* convert the "tag_bits" mask to an array of enum
+	/* convert the tag bits of the mask to an array of enum
 	   mpd_tag_type for mpd_send_enable_tag_types() */
 
-	enum mpd_tag_type types[64];
+	enum mpd_tag_type types[MPD_TAG_COUNT];
 	unsigned n = 0;
 
-	for (unsigned i = 0; i < 64; ++i)
-		if (tag_bits & ((uint64_t)1 << i))
+	for (unsigned i = 0; i < MPD_TAG_COUNT; ++i)
+		if (mask & ((uint64_t)1 << i))
 			types[n++] = (enum mpd_tag_type)i;
 
 	return n == 0 || mpd_send_enable_tag_types(c, types, n);
 }
+
+bool
+tag_types_changed(void)
+{
+	return tag_types_modified;
+}
+
+bool
+send_all_tag_types(struct mpd_connection *c)
+{
+#if LIBMPDCLIENT_CHECK_VERSION(2,19,0)
+	if (!mpd_send_all_tag_types(c))
+		return false;
+#else
+	if (!mpd_send_command(c, "tagtypes", "all", NULL))
+		return false;
+#endif
+
+	tag_types_modified = false;
+	return true;
+}
@@ -4,6 +4,8 @@
 #ifndef MPC_TAGS_H
 #define MPC_TAGS_H
 
+#include "Compiler.h"
+
 #include <stdbool.h>
 
 struct mpd_connection;
@@ -20,4 +22,20 @@ bool
 send_tag_types_for_format(struct mpd_connection *c,
 			  const char *format);
 
+/**
+ * Has send_tag_types_for_format() been called since the last
+ * send_all_tag_types()?  Commands which do not call it expect MPD's
+ * default (all tags), so a connection which runs several commands
+ * must restore it first.
+ */
+gcc_pure
+bool
+tag_types_changed(void);
+
+/**
+ * Send "tagtypes all", restoring MPD's default.
+ */
+bool
+send_all_tag_types(struct mpd_connection *c);
+
 #endif
@@ -0,0 +1,516 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "trace.h"
+#include "Compiler.h"
+
+#include <mpd/client.h>
+#include <mpd/async.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**
+ * One request (a command or a command list) and its response.
+ */
+struct trace_request {
+	/**
+	 * The command name, or "command_list".
+	 */
+	char name[32];
+
+	/**
+	 * The number of commands; more than one for a command list.
+	 */
+	unsigned n_commands;
+
+	/**
+	 * The time the request was sent, the time the first response
+	 * byte was received and the time the response was complete
+	 * (in milliseconds since trace_begin()).  Negative if it has
+	 * not happened yet.
+	 */
+	double sent, first, done;
+
+	size_t bytes_sent, bytes_received;
+
+	/**
+	 * The number of "name: value" lines in the response.
+	 */
+	unsigned pairs;
+};
+
+/**
+ * The beginning of a protocol line, which may be split across
+ * several reads.  Only the beginning is needed to classify it.
+ */
+struct trace_line {
+	char data[64];
+	size_t length;
+};
+
+static struct {
+	bool running;
+
+	struct timespec start;
+
+	/**
+	 * The duration of the handshake before trace_connect().
+	 */
+	double connected;
+
+	/**
+	 * The original connection; its socket is connected to MPD.
+	 */
+	struct mpd_connection *upstream;
+	int server_fd;
+
+	/**
+	 * The relay's end of the socket pair whose other end is used
+	 * by the connection returned by trace_connect().
+	 */
+	int client_fd;
+
+	/**
+	 * Written by trace_finish() to stop the relay.
+	 */
+	int stop_pipe[2];
+
+	pthread_t thread;
+
+	struct trace_request *requests;
+	unsigned n_requests, max_requests;
+
+	/**
+	 * The request whose response is being received.
+	 */
+	unsigned response_index;
+
+	/**
+	 * Is a command list being sent?
+	 */
+	bool in_list;
+
+	struct trace_line request_line, response_line;
+
+	/**
+	 * The number of raw bytes remaining in the current "binary"
+	 * chunk, including the newline after it.
+	 */
+	size_t binary_remaining;
+} trace;
+
+static double
+trace_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - trace.start.tv_sec) * 1e3 +
+		(now.tv_nsec - trace.start.tv_nsec) / 1e6;
+}
+
+gcc_pure
+static bool
+line_is(const struct trace_line *line, const char *s)
+{
+	return strcmp(line->data, s) == 0;
+}
+
+gcc_pure
+static bool
+line_starts_with(const struct trace_line *line, const char *prefix)
+{
+	return strncmp(line->data, prefix, strlen(prefix)) == 0;
+}
+
+/**
+ * Append the beginning of a line to the buffer, discarding what
+ * does not fit.
+ */
+static void
+line_append(struct trace_line *line, const char *data, size_t length)
+{
+	const size_t available = sizeof(line->data) - 1 - line->length;
+	if (length > available)
+		length = available;
+
+	memcpy(line->data + line->length, data, length);
+	line->length += length;
+	line->data[line->length] = 0;
+}
+
+static struct trace_request *
+trace_add_request(const char *name, double now)
+{
+	if (trace.n_requests == trace.max_requests) {
+		trace.max_requests = trace.max_requests > 0
+			? trace.max_requests * 2 : 64;
+		trace.requests = realloc(trace.requests,
+					 trace.max_requests *
+					 sizeof(*trace.requests));
+	}
+
+	struct trace_request *r = &trace.requests[trace.n_requests++];
+	const size_t length = strcspn(name, " ");
+	snprintf(r->name, sizeof(r->name), "%.*s", (int)length, name);
+	r->n_commands = 1;
+	r->sent = now;
+	r->first = r->done = -1;
+	r->bytes_sent = r->bytes_received = 0;
+	r->pairs = 0;
+	return r;
+}
+
+/**
+ * The request being sent, or NULL if there is none.
+ */
+gcc_pure
+static struct trace_request *
+trace_last_request(void)
+{
+	return trace.n_requests > 0
+		? &trace.requests[trace.n_requests - 1]
+		: NULL;
+}
+
+/**
+ * The request whose response is being received, or NULL if there is
+ * none.
+ */
+gcc_pure
+static struct trace_request *
+trace_response_request(void)
+{
+	return trace.response_index < trace.n_requests
+		? &trace.requests[trace.response_index]
+		: NULL;
+}
+
+static void
+trace_request_line(const struct trace_line *line, double now)
+{
+	if (trace.in_list) {
+		struct trace_request *r = trace_last_request();
+		if (line_is(line, "command_list_end")) {
+			trace.in_list = false;
+			/* MPD starts executing the list now */
+			r->sent = now;
+		} else
+			++r->n_commands;
+	} else if (line_is(line, "command_list_begin") ||
+		   line_is(line, "command_list_ok_begin")) {
+		struct trace_request *r =
+			trace_add_request("command_list", now);
+		r->n_commands = 0;
+		trace.in_list = true;
+	} else if (!line_is(line, "noidle"))
+		/* "noidle" only ends the pending "idle" */
+		trace_add_request(line->data, now);
+}
+
+/**
+ * Parse data sent by mpc.
+ */
+static void
+trace_request_data(const char *data, size_t length, double now)
+{
+	while (length > 0) {
+		const char *eol = memchr(data, '\n', length);
+		const size_t n = eol != NULL ? (size_t)(eol + 1 - data) : length;
+
+		line_append(&trace.request_line, data,
+			    eol != NULL ? n - 1 : n);
+		data += n;
+		length -= n;
+
+		if (eol == NULL)
+			break;
+
+		trace_request_line(&trace.request_line, now);
+		trace.request_line.length = 0;
+
+		struct trace_request *r = trace_last_request();
+		if (r != NULL)
+			r->bytes_sent += n;
+	}
+}
+
+static void
+trace_response_line(struct trace_request *r, const struct trace_line *line,
+		    double now)
+{
+	if (line_starts_with(line, "binary: "))
+		trace.binary_remaining = strtoull(line->data + 8, NULL, 10) + 1;
+	else if (line_is(line, "OK") || line_starts_with(line, "ACK ")) {
+		r->done = now;
+		++trace.response_index;
+	} else if (!line_is(line, "list_OK"))
+		++r->pairs;
+}
+
+/**
+ * Parse data received from MPD.
+ */
+static void
+trace_response_data(const char *data, size_t length, double now)
+{
+	while (length > 0) {
+		struct trace_request *r = trace_response_request();
+		if (r == NULL)
+			/* unexpected; ignore it */
+			break;
+
+		if (r->first < 0)
+			r->first = now;
+
+		if (trace.binary_remaining > 0) {
+			const size_t n = length < trace.binary_remaining
+				? length : trace.binary_remaining;
+			r->bytes_received += n;
+			trace.binary_remaining -= n;
+			data += n;
+			length -= n;
+			continue;
+		}
+
+		const char *eol = memchr(data, '\n', length);
+		const size_t n = eol != NULL ? (size_t)(eol + 1 - data) : length;
+
+		line_append(&trace.response_line, data,
+			    eol != NULL ? n - 1 : n);
+		r->bytes_received += n;
+		data += n;
+		length -= n;
+
+		if (eol != NULL) {
+			trace_response_line(r, &trace.response_line, now);
+			trace.response_line.length = 0;
+		}
+	}
+}
+
+static bool
+write_full(int fd, const char *data, size_t length)
+{
+	while (length > 0) {
+		const ssize_t n = write(fd, data, length);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		data += n;
+		length -= n;
+	}
+
+	return true;
+}
+
+/**
+ * Forward data between mpc and MPD, and record what passes by.
+ */
+static void *
+trace_relay(gcc_unused void *arg)
+{
+	struct pollfd fds[3] = {
+		{ .fd = trace.client_fd, .events = POLLIN },
+		{ .fd = trace.server_fd, .events = POLLIN },
+		{ .fd = trace.stop_pipe[0], .events = POLLIN },
+	};
+
+	static char buffer[64 * 1024];
+
+	while (true) {
+		if (poll(fds, 3, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (fds[2].revents != 0)
+			break;
+
+		if (fds[0].revents != 0) {
+			const ssize_t n = recv(trace.client_fd, buffer,
+					       sizeof(buffer), 0);
+			if (n <= 0 || !write_full(trace.server_fd, buffer, n))
+				break;
+
+			trace_request_data(buffer, n, trace_now());
+		}
+
+		if (fds[1].revents != 0) {
+			const ssize_t n = recv(trace.server_fd, buffer,
+					       sizeof(buffer), 0);
+			const double now = trace_now();
+			if (n <= 0)
+				break;
+
+			trace_response_data(buffer, n, now);
+
+			if (!write_full(trace.client_fd, buffer, n))
+				break;
+		}
+	}
+
+	/* let libmpdclient see the end of the connection */
+	shutdown(trace.client_fd, SHUT_RDWR);
+	return NULL;
+}
+
+void
+trace_begin(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &trace.start);
+}
+
+struct mpd_connection *
+trace_connect(struct mpd_connection *conn)
+{
+	trace.connected = trace_now();
+
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, fds) < 0) {
+		perror("socketpair() failed");
+		return conn;
+	}
+
+	if (pipe2(trace.stop_pipe, O_CLOEXEC) < 0) {
+		perror("pipe() failed");
+		close(fds[0]);
+		close(fds[1]);
+		return conn;
+	}
+
+	const unsigned *version = mpd_connection_get_server_version(conn);
+	char welcome[64];
+	snprintf(welcome, sizeof(welcome), "OK MPD %u.%u.%u",
+		 version[0], version[1], version[2]);
+
+	struct mpd_async *async = mpd_async_new(fds[0]);
+	struct mpd_connection *traced = async != NULL
+		? mpd_connection_new_async(async, welcome)
+		: NULL;
+	if (traced == NULL) {
+		fputs("Out of memory\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+
+	trace.upstream = conn;
+	trace.server_fd = mpd_connection_get_fd(conn);
+	trace.client_fd = fds[1];
+
+	if (pthread_create(&trace.thread, NULL, trace_relay, NULL) != 0) {
+		fputs("Failed to create thread\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+
+	trace.running = true;
+	atexit(trace_finish);
+
+	return traced;
+}
+
+static double
+timeval_ms(const struct timeval *tv)
+{
+	return tv->tv_sec * 1e3 + tv->tv_usec / 1e3;
+}
+
+static void
+print_duration(double ms)
+{
+	if (ms >= 0)
+		fprintf(stderr, " %9.3f", ms);
+	else
+		fprintf(stderr, " %9s", "-");
+}
+
+static void
+trace_print(double wall)
+{
+	fprintf(stderr, "trace: %-20s %9s %9s %9s %9s %7s %9s\n",
+		"request", "sent", "first", "done", "bytes", "pairs",
+		"local");
+
+	unsigned n_commands = 0, n_pairs = 0;
+	size_t bytes_sent = 0, bytes_received = 0;
+	double network = 0;
+
+	for (unsigned i = 0; i < trace.n_requests; ++i) {
+		const struct trace_request *r = &trace.requests[i];
+
+		fprintf(stderr, "trace: %-20s %9.3f", r->name, r->sent);
+		print_duration(r->first >= 0 ? r->first - r->sent : -1);
+		print_duration(r->done >= 0 ? r->done - r->sent : -1);
+		fprintf(stderr, " %9zu %7u", r->bytes_received, r->pairs);
+
+		/* the time spent by mpc until its next request */
+		if (r->done >= 0) {
+			const double next = i + 1 < trace.n_requests
+				? trace.requests[i + 1].sent
+				: wall;
+			print_duration(next - r->done);
+			network += r->done - r->sent;
+		} else
+			print_duration(-1);
+
+		fputc('\n', stderr);
+
+		n_commands += r->n_commands;
+		n_pairs += r->pairs;
+		bytes_sent += r->bytes_sent;
+		bytes_received += r->bytes_received;
+	}
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	fprintf(stderr,
+		"trace: %u round trips (%u commands), %zu bytes sent, "
+		"%zu bytes received, %u pairs\n",
+		trace.n_requests, n_commands, bytes_sent, bytes_received,
+		n_pairs);
+	fprintf(stderr,
+		"trace: wall %.3f ms = connect %.3f + network %.3f "
+		"+ local %.3f; CPU user %.3f ms, system %.3f ms\n",
+		wall, trace.connected, network,
+		wall - trace.connected - network,
+		timeval_ms(&usage.ru_utime), timeval_ms(&usage.ru_stime));
+}
+
+void
+trace_finish(void)
+{
+	if (!trace.running)
+		return;
+
+	trace.running = false;
+
+	/* the time spent printing counts as local time */
+	fflush(stdout);
+
+	const double wall = trace_now();
+
+	if (write(trace.stop_pipe[1], "", 1) > 0)
+		pthread_join(trace.thread, NULL);
+
+	trace_print(wall);
+
+	mpd_connection_free(trace.upstream);
+	close(trace.client_fd);
+	close(trace.stop_pipe[0]);
+	close(trace.stop_pipe[1]);
+	free(trace.requests);
+}
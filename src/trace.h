@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef MPC_TRACE_H
+#define MPC_TRACE_H
+
+struct mpd_connection;
+
+/**
+ * Start the trace clock.  Call this before connecting to MPD, so the
+ * handshake is accounted for.
+ */
+void
+trace_begin(void);
+
+/**
+ * Route the connection through a relay thread which records the
+ * timing and size of each request and response.
+ *
+ * @param conn a newly established connection; it is owned by the
+ * relay from now on
+ * @return a new connection to be used instead
+ */
+struct mpd_connection *
+trace_connect(struct mpd_connection *conn);
+
+/**
+ * Stop the relay and print the recorded requests and a summary to
+ * stderr.  Does nothing if trace_connect() was not called.  This is
+ * registered with atexit() by trace_connect().
+ */
+void
+trace_finish(void);
+
+#endif
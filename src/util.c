@@ -2,20 +2,55 @@
 // Copyright The Music Player Daemon Project
 
 #include "util.h"
+#include "args.h"
 #include "song_format.h"
+#include "buffer.h"
 #include "charset.h"
 #include "list.h"
 #include "options.h"
+#include "writer.h"
+#include "tags.h"
 
 #include <mpd/client.h>
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 #include <assert.h>
 
+/**
+ * Where abort_command() jumps to; NULL means exit the process.
+ */
+static jmp_buf *command_abort_target;
+
 void
-printErrorAndExit(struct mpd_connection *conn)
+set_command_abort_target(jmp_buf *target)
+{
+	command_abort_target = target;
+}
+
+void
+abort_command(int status)
+{
+	assert(status != 0);
+
+	if (command_abort_target != NULL)
+		longjmp(*command_abort_target, status);
+
+	exit(status);
+}
+
+/**
+ * Print the connection's error message and abort the command.
+ *
+ * @param step the name of the setup command which has failed, or
+ * NULL
+ */
+gcc_noreturn
+static void
+print_error_and_exit(struct mpd_connection *conn, const char *step)
 {
 	assert(mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS);
 
@@ -25,9 +60,23 @@ printErrorAndExit(struct mpd_connection *conn)
 		   rest is either US-ASCII or locale */
 		message = charset_from_utf8(message);
 
-	fprintf(stderr, "MPD error: %s\n", message);
-	mpd_connection_free(conn);
-	exit(EXIT_FAILURE);
+	if (step != NULL)
+		fprintf(stderr, "MPD error (%s): %s\n", step, message);
+	else
+		fprintf(stderr, "MPD error: %s\n", message);
+
+	/* in batch mode, the connection is recovered (or freed) by
+	   the batch loop */
+	if (command_abort_target == NULL)
+		mpd_connection_free(conn);
+
+	abort_command(EXIT_FAILURE);
+}
+
+void
+printErrorAndExit(struct mpd_connection *conn)
+{
+	print_error_and_exit(conn, NULL);
 }
 
 void
@@ -37,9 +86,105 @@ my_finishCommand(struct mpd_connection *conn)
 		printErrorAndExit(conn);
 }
 
+static bool deferred_enabled;
+
+/**
+ * Is the shared command list of deferred commands open?
+ */
+static bool deferred_list_open;
+
+/**
+ * The number of setup commands (see deferred_setup()) at the
+ * beginning of the shared command list.
+ */
+static unsigned deferred_n_setup;
+
+/**
+ * The names of the setup commands, for error messages.
+ */
+static const char *deferred_setup_steps[3];
+
+/**
+ * Report an error of the shared command list, attributing it to the
+ * setup command which has failed (if any).
+ */
+gcc_noreturn
+static void
+deferred_error(struct mpd_connection *conn, unsigned n_setup)
+{
+	if (mpd_connection_get_error(conn) == MPD_ERROR_SERVER) {
+		const unsigned location =
+			mpd_connection_get_server_error_location(conn);
+		if (location < n_setup)
+			print_error_and_exit(conn,
+					     deferred_setup_steps[location]);
+	}
+
+	print_error_and_exit(conn, NULL);
+}
+
+bool
+deferred_list_commit(struct mpd_connection *conn, unsigned *location_r)
+{
+	const unsigned n_setup = deferred_list_open ? deferred_n_setup : 0;
+	deferred_list_open = false;
+	deferred_n_setup = 0;
+
+	if (!mpd_command_list_end(conn))
+		printErrorAndExit(conn);
+
+	if (mpd_response_finish(conn))
+		return true;
+
+	if (mpd_connection_get_error(conn) == MPD_ERROR_SERVER) {
+		const unsigned location =
+			mpd_connection_get_server_error_location(conn);
+		if (location >= n_setup) {
+			*location_r = location - n_setup;
+			return false;
+		}
+	}
+
+	deferred_error(conn, n_setup);
+}
+
+/**
+ * Send "status" at the end of the open shared command list, and
+ * receive its response.  All commands before it have empty
+ * responses.
+ */
+static struct mpd_status *
+deferred_status(struct mpd_connection *conn)
+{
+	const unsigned n_setup = deferred_n_setup;
+	deferred_list_open = false;
+	deferred_n_setup = 0;
+
+	if (!mpd_send_status(conn) || !mpd_command_list_end(conn))
+		printErrorAndExit(conn);
+
+	/* skip the "list_OK" responses of the commands before
+	   "status" */
+	struct mpd_pair *pair;
+	while ((pair = mpd_recv_pair(conn)) == NULL)
+		if (!mpd_response_next(conn))
+			deferred_error(conn, n_setup);
+
+	mpd_enqueue_pair(conn, pair);
+
+	struct mpd_status *status = mpd_recv_status(conn);
+	if (status == NULL || !mpd_response_finish(conn))
+		printErrorAndExit(conn);
+
+	return status;
+}
+
 struct mpd_status *
 getStatus(struct mpd_connection *conn)
 {
+	if (deferred_list_open)
+		return deferred_status(conn);
+
 	struct mpd_status *ret = mpd_run_status(conn);
 	if (ret == NULL)
 		printErrorAndExit(conn);
@@ -47,27 +192,286 @@ getStatus(struct mpd_connection *conn)
 	return ret;
 }
 
+/**
+ * Open the shared command list.  The "discrete" mode allows
+ * deferred_status() to find the "status" response.
+ */
 static void
-print_formatted_song(const struct mpd_song *song, const char * format)
+deferred_open(struct mpd_connection *conn)
 {
-	char * str = format_song(song, format);
+	assert(!deferred_list_open);
 
-	if(str) {
-		printf("%s", str);
-		free(str);
+	if (!mpd_command_list_begin(conn, true))
+		printErrorAndExit(conn);
+
+	deferred_list_open = true;
+	deferred_n_setup = 0;
+}
+
+void
+deferred_enable(void)
+{
+	deferred_enabled = true;
+}
+
+bool
+deferred_active(void)
+{
+	return deferred_enabled;
+}
+
+void
+deferred_setup(struct mpd_connection *conn,
+	       const char *password, const char *partition)
+{
+	if (password == NULL && partition == NULL)
+		return;
+
+	deferred_open(conn);
+
+	if (password != NULL) {
+		if (!mpd_send_password(conn, password))
+			printErrorAndExit(conn);
+		deferred_setup_steps[deferred_n_setup++] = "password";
+	}
+
+	if (partition != NULL) {
+		if (!mpd_send_switch_partition(conn, partition))
+			printErrorAndExit(conn);
+		deferred_setup_steps[deferred_n_setup++] = "partition";
 	}
 }
 
+void
+deferred_reset_tag_types(struct mpd_connection *conn)
+{
+	if (!tag_types_changed())
+		return;
+
+	/* it is a setup command, so nothing else may be in the
+	   shared command list before it */
+	deferred_flush(conn);
+	deferred_open(conn);
+
+	if (!send_all_tag_types(conn))
+		printErrorAndExit(conn);
+	deferred_setup_steps[deferred_n_setup++] = "tagtypes";
+}
+
+void
+deferred_discard(void)
+{
+	deferred_list_open = false;
+	deferred_n_setup = 0;
+}
+
+void
+deferred_begin(struct mpd_connection *conn)
+{
+	if (deferred_enabled && !deferred_list_open)
+		deferred_open(conn);
+}
+
+void
+deferred_end(struct mpd_connection *conn)
+{
+	if (deferred_enabled)
+		return;
+
+	if (deferred_list_open)
+		deferred_flush(conn);
+	else
+		my_finishCommand(conn);
+}
+
+void
+deferred_list_begin(struct mpd_connection *conn)
+{
+	if (deferred_enabled)
+		deferred_begin(conn);
+	else if (!deferred_list_open &&
+		 !mpd_command_list_begin(conn, false))
+		printErrorAndExit(conn);
+}
+
+void
+deferred_list_end(struct mpd_connection *conn)
+{
+	if (deferred_enabled)
+		return;
+
+	unsigned location;
+	if (!deferred_list_commit(conn, &location))
+		printErrorAndExit(conn);
+}
+
+void
+deferred_flush(struct mpd_connection *conn)
+{
+	if (!deferred_list_open)
+		return;
+
+	unsigned location;
+	if (!deferred_list_commit(conn, &location))
+		printErrorAndExit(conn);
+}
+
+bool
+resync_connection(struct mpd_connection *conn)
+{
+	deferred_discard();
+
+	/* a search which has not been committed is discarded */
+	mpd_search_cancel(conn);
+
+	if (!mpd_connection_clear_error(conn))
+		return false;
+
+	/* consume the rest of an unfinished response */
+	if (!mpd_response_finish(conn) &&
+	    !mpd_connection_clear_error(conn))
+		return false;
+
+	/* an unfinished command list cannot be discarded, only
+	   ended, which executes the commands sent so far; without
+	   one, this fails with MPD_ERROR_STATE */
+	if (mpd_command_list_end(conn))
+		mpd_response_finish(conn);
+
+	return mpd_connection_clear_error(conn);
+}
+
+/**
+ * Send one chunk of lines as a command list (without waiting for the
+ * response).
+ */
+static void
+send_line_chunk(struct mpd_connection *conn, const struct line_chunk *chunk,
+		void (*prepare)(struct mpd_connection *conn,
+				unsigned n, char **lines),
+		bool (*send)(struct mpd_connection *conn, char *line))
+{
+	if (prepare != NULL)
+		prepare(conn, chunk->n_lines, chunk->lines);
+
+	if (!mpd_command_list_begin(conn, false))
+		printErrorAndExit(conn);
+
+	for (unsigned i = 0; i < chunk->n_lines; ++i)
+		if (!send(conn, chunk->lines[i]))
+			printErrorAndExit(conn);
+
+	if (!mpd_command_list_end(conn))
+		printErrorAndExit(conn);
+}
+
+void
+send_stdin_lines(struct mpd_connection *conn, const char *verb,
+		 void (*prepare)(struct mpd_connection *conn,
+				 unsigned n, char **lines),
+		 bool (*send)(struct mpd_connection *conn, char *line))
+{
+	/* the lines are sent in their own command lists */
+	deferred_flush(conn);
+
+	struct line_reader reader;
+	line_reader_init(&reader, stdin);
+
+	struct line_chunk chunks[2];
+	line_chunk_init(&chunks[0]);
+	line_chunk_init(&chunks[1]);
+
+	unsigned current = 0;
+	line_reader_read(&reader, &chunks[current]);
+
+	while (chunks[current].n_lines > 0) {
+		const struct line_chunk *chunk = &chunks[current];
+		send_line_chunk(conn, chunk, prepare, send);
+
+		/* read the next chunk while MPD executes this one */
+		current = !current;
+		line_reader_read(&reader, &chunks[current]);
+
+		if (!mpd_response_finish(conn)) {
+			/* the location is only known for errors
+			   reported by MPD */
+			const unsigned location =
+				mpd_connection_get_error(conn) == MPD_ERROR_SERVER
+				? mpd_connection_get_server_error_location(conn)
+				: UINT_MAX;
+			if (location < chunk->n_lines) {
+				const char *message =
+					mpd_connection_get_error_message(conn);
+				message = charset_from_utf8(message);
+				fprintf(stderr, "error %s %s (line %u): %s\n",
+					verb, chunk->lines[location],
+					chunk->first_line + location,
+					message);
+				abort_command(EXIT_FAILURE);
+			}
+
+			printErrorAndExit(conn);
+		}
+	}
+
+	line_chunk_deinit(&chunks[0]);
+	line_chunk_deinit(&chunks[1]);
+	line_reader_deinit(&reader);
+}
+
+/**
+ * The buffer used by print_formatted_song(); it is reused for all
+ * songs, so printing a long list does not allocate memory for each
+ * song.
+ */
+static struct mpc_buffer song_buffer;
+
+static void
+print_formatted_song(const struct mpd_song *song, const char * format)
+{
+	mpc_buffer_clear(&song_buffer);
+
+	if (format_song_write(&song_buffer, song, format))
+		writer_write(song_buffer.data, song_buffer.length);
+}
+
 void
 pretty_print_song(const struct mpd_song *song)
 {
 	print_formatted_song(song, options.format);
 }
 
+void
+print_utf8_line(struct mpc_buffer *buffer, const char *s)
+{
+	mpc_buffer_clear(buffer);
+	writer_line(charset_from_utf8_buffer(buffer, s, strlen(s)));
+}
+
+/**
+ * Print a song in a list, unless it is filtered by "--with-prio".
+ */
+static void
+print_song(struct mpc_buffer *buffer, const struct mpd_song *song,
+	   bool pretty)
+{
+	if (options.with_prio && mpd_song_get_prio(song) == 0)
+		return;
+
+	if (pretty) {
+		pretty_print_song(song);
+		writer_putc('\n');
+	} else
+		print_utf8_line(buffer, mpd_song_get_uri(song));
+}
+
 void
 print_entity_list(struct mpd_connection *c, enum mpd_entity_type filter_type,
 		  bool pretty)
 {
+	struct mpc_buffer buffer;
+	mpc_buffer_init(&buffer);
+
 	struct mpd_entity *entity;
 	while ((entity = mpd_recv_entity(c)) != NULL) {
 		const struct mpd_directory *dir;
@@ -85,40 +489,162 @@ print_entity_list(struct mpd_connection *c, enum mpd_entity_type filter_type,
 
 		case MPD_ENTITY_TYPE_DIRECTORY:
 			dir = mpd_entity_get_directory(entity);
-			printf("%s\n", charset_from_utf8(mpd_directory_get_path(dir)));
+			print_utf8_line(&buffer, mpd_directory_get_path(dir));
 			break;
 
 		case MPD_ENTITY_TYPE_SONG:
 			song = mpd_entity_get_song(entity);
-			if (!options.with_prio || mpd_song_get_prio(song) > 0) {
-				if (pretty) {
-					pretty_print_song(song);
-					puts("");
-				} else
-					printf("%s\n", charset_from_utf8(mpd_song_get_uri(song)));
-			}
+			print_song(&buffer, song, pretty);
 			break;
 
 		case MPD_ENTITY_TYPE_PLAYLIST:
 			playlist = mpd_entity_get_playlist(entity);
-			printf("%s\n", charset_from_utf8(mpd_playlist_get_path(playlist)));
+			print_utf8_line(&buffer, mpd_playlist_get_path(playlist));
 			break;
 		}
 
 		mpd_entity_free(entity);
 	}
+
+	mpc_buffer_deinit(&buffer);
+}
+
+/**
+ * Handle a failure of the send() callback of print_song_pages().
+ */
+static bool
+send_page_failed(struct mpd_connection *conn)
+{
+	if (mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS)
+		printErrorAndExit(conn);
+
+	/* the callback has printed a message */
+	return false;
+}
+
+bool
+print_song_pages(struct mpd_connection *conn,
+		 bool (*send)(struct mpd_connection *conn,
+			      unsigned start, unsigned end, bool first,
+			      void *ctx),
+		 void *ctx, bool pretty)
+{
+	const unsigned end = options.range.end;
+	const unsigned page_size = options.page_size > 0
+		? options.page_size
+		: UINT_MAX;
+
+	unsigned start = options.range.start;
+	if (start >= end)
+		return true;
+
+	unsigned page_end = end - start > page_size
+		? start + page_size
+		: end;
+
+	if (!send(conn, start, page_end, true, ctx))
+		return send_page_failed(conn);
+
+	struct mpc_buffer buffer;
+	mpc_buffer_init(&buffer);
+
+	struct mpd_song **songs = NULL;
+	unsigned capacity = 0;
+
+	while (true) {
+		/* the songs are buffered only if another window may
+		   follow, so its request can be sent before they are
+		   printed */
+		const bool last = page_end >= end;
+
+		unsigned n = 0;
+		struct mpd_song *song;
+		while ((song = mpd_recv_song(conn)) != NULL) {
+			if (last) {
+				print_song(&buffer, song, pretty);
+				mpd_song_free(song);
+				continue;
+			}
+
+			if (n == capacity) {
+				capacity = capacity > 0 ? capacity * 2 : 256;
+				songs = realloc(songs,
+						capacity * sizeof(*songs));
+			}
+
+			songs[n++] = song;
+		}
+
+		my_finishCommand(conn);
+
+		/* a short page is the last one */
+		const bool more = !last && n == page_end - start;
+		if (more) {
+			/* MPD prepares the next page while this one
+			   is being printed */
+			start = page_end;
+			page_end = end - start > page_size
+				? start + page_size
+				: end;
+
+			if (!send(conn, start, page_end, false, ctx))
+				/* the arguments have been accepted
+				   for the first page already */
+				printErrorAndExit(conn);
+		}
+
+		for (unsigned i = 0; i < n; ++i) {
+			print_song(&buffer, songs[i], pretty);
+			mpd_song_free(songs[i]);
+		}
+
+		if (!more)
+			break;
+
+		writer_flush();
+	}
+
+	free(songs);
+	mpc_buffer_deinit(&buffer);
+	return true;
 }
 
 void
-print_filenames(struct mpd_connection *conn)
+print_song_range(struct mpd_connection *conn, bool pretty)
 {
+	struct mpc_buffer buffer;
+	mpc_buffer_init(&buffer);
+
+	unsigned i = 0;
 	struct mpd_song *song;
+	while ((song = mpd_recv_song(conn)) != NULL) {
+		if (i >= options.range.start && i < options.range.end)
+			print_song(&buffer, song, pretty);
 
+		mpd_song_free(song);
+		++i;
+	}
+
+	mpc_buffer_deinit(&buffer);
+
+	if (mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS)
+		printErrorAndExit(conn);
+}
+
+void
+print_filenames(struct mpd_connection *conn)
+{
+	struct mpc_buffer buffer;
+	mpc_buffer_init(&buffer);
+
+	struct mpd_song *song;
 	while ((song = mpd_recv_song(conn)) != NULL) {
-		printf("%s\n", charset_from_utf8(mpd_song_get_uri(song)));
+		print_utf8_line(&buffer, mpd_song_get_uri(song));
 		mpd_song_free(song);
 	}
 
+	mpc_buffer_deinit(&buffer);
+
 	if (mpd_connection_get_error(conn) != MPD_ERROR_SUCCESS)
 		printErrorAndExit(conn);
 }
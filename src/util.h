@@ -4,31 +4,70 @@
 #ifndef MPC_UTIL_H
 #define MPC_UTIL_H
 
+#include "Compiler.h"
+
 #include <mpd/client.h>
 
+#include <setjmp.h>
+#include <stdbool.h>
+
 struct mpd_connection;
 struct mpd_song;
+struct mpc_buffer;
 
 #define DIE(...) do { fprintf(stderr, __VA_ARGS__); return -1; } while(0)
 
+/**
+ * Define a command handler which sends one command without
+ * arguments with the given mpd_send_*() function.  It can be
+ * deferred (see deferred_begin()).
+ */
 #define SIMPLE_CMD(funcname, libmpdclient_funcname, ret) \
 int funcname(gcc_unused int argc, gcc_unused char **argv, \
 	     struct mpd_connection *conn) { \
+	deferred_begin(conn); \
 	if (!libmpdclient_funcname(conn)) \
 		printErrorAndExit(conn); \
+	deferred_end(conn); \
 	return ret; \
 }
 
 #define SIMPLE_ONEARG_CMD(funcname, libmpdclient_funcname, ret) \
 int funcname (gcc_unused int argc, char **argv, struct mpd_connection *conn) { \
+	deferred_begin(conn); \
 	if (!libmpdclient_funcname(conn, charset_to_utf8(argv[0]))) \
 		printErrorAndExit(conn); \
+	deferred_end(conn); \
 	return ret; \
 }
 
+/**
+ * Print the connection's error message and abort the command with
+ * abort_command().  Outside of batch mode, the connection is freed
+ * before the process exits.
+ */
 void
 printErrorAndExit(struct mpd_connection *conn);
 
+/**
+ * Abort the running command with the given (non-zero) exit status.
+ * This exits the process, unless set_command_abort_target() has
+ * installed a jump target.
+ */
+gcc_noreturn
+void
+abort_command(int status);
+
+/**
+ * Let abort_command() jump to the given target (with the exit status
+ * as setjmp() return value) instead of exiting the process.  This is
+ * used by "batch" to run many commands in one process.
+ *
+ * @param target the jump target; NULL restores the default
+ */
+void
+set_command_abort_target(jmp_buf *target);
+
 /**
  * Call mpd_response_finish(), and if that fails, call
  * printErrorAndExit().
@@ -36,12 +75,147 @@ printErrorAndExit(struct mpd_connection *conn);
 void
 my_finishCommand(struct mpd_connection *conn);
 
+/**
+ * Query the status.  Deferred commands are flushed first.
+ */
 struct mpd_status *
 getStatus(struct mpd_connection *conn);
 
+/**
+ * Enable deferred sending: commands which only expect "OK" from the
+ * server are collected in one command list, and their responses are
+ * checked only by deferred_flush().  This is used for chained
+ * commands.
+ */
+void
+deferred_enable(void);
+
+gcc_pure
+bool
+deferred_active(void);
+
+/**
+ * Queue "password" and "partition" (each may be NULL) at the
+ * beginning of the shared command list, so they are sent together
+ * with the first command instead of waiting for their responses
+ * separately.  Their errors are reported with the name of the
+ * failed step.
+ */
+void
+deferred_setup(struct mpd_connection *conn,
+	       const char *password, const char *partition);
+
+/**
+ * If the previous command has changed the tag types (see
+ * send_tag_types_for_format()), queue "tagtypes all" as a setup
+ * command, so it is sent together with the next command.  Call this
+ * between two commands which run on the same connection.
+ */
+void
+deferred_reset_tag_types(struct mpd_connection *conn);
+
+/**
+ * Forget the shared command list after the connection has been
+ * resynchronized (see resync_connection()) following an aborted
+ * command.
+ */
+void
+deferred_discard(void);
+
+/**
+ * Call this before sending a command whose response is only "OK".
+ * If deferred sending is enabled, this opens the shared command list
+ * (if it is not open already).  If the shared command list is open,
+ * the command is appended to it.
+ */
+void
+deferred_begin(struct mpd_connection *conn);
+
+/**
+ * Call this after sending a command started with deferred_begin().
+ * Unless it is deferred, this reads the response (and the responses
+ * of the setup commands before it).
+ */
+void
+deferred_end(struct mpd_connection *conn);
+
+/**
+ * Like deferred_begin(), but for handlers which send several
+ * commands in a command list: without deferred sending, a new command
+ * list is opened.
+ */
+void
+deferred_list_begin(struct mpd_connection *conn);
+
+/**
+ * Finish a command list opened by deferred_list_begin().
+ */
+void
+deferred_list_end(struct mpd_connection *conn);
+
+/**
+ * Like deferred_list_end(), but let the caller handle server errors
+ * of its own commands.  Must not be called if deferred sending is
+ * enabled.
+ *
+ * @param location_r on server error, the index of the failed command
+ * within the caller's command list, not counting setup commands
+ * @return false on server error
+ */
+bool
+deferred_list_commit(struct mpd_connection *conn, unsigned *location_r);
+
+/**
+ * Send all deferred commands and check their responses.  This must
+ * be called before reading a response of another command, except
+ * for getStatus(), which appends "status" to the shared command
+ * list.
+ */
+void
+deferred_flush(struct mpd_connection *conn);
+
+/**
+ * Bring the connection back to a state where the next command can be
+ * sent after a command has failed or has been aborted: clear a
+ * server error, discard an unfinished search, end an unfinished
+ * command list and consume unfinished responses.
+ *
+ * @return false if the connection is broken
+ */
+bool
+resync_connection(struct mpd_connection *conn);
+
+/**
+ * Read lines from stdin in chunks and send one command per line, each
+ * chunk in its own command list.  The next chunk is read while MPD
+ * executes the previous one, and only two chunks are kept in memory.
+ * On a server error, the failed line and its line number are printed
+ * and the command is aborted; the lines before it have been executed.
+ *
+ * @param verb describes the operation in the error message,
+ * e.g. "adding"
+ * @param prepare an optional function called before a chunk is sent;
+ * the connection has no pending response then
+ * @param send sends the command for one line
+ */
+void
+send_stdin_lines(struct mpd_connection *conn, const char *verb,
+		 void (*prepare)(struct mpd_connection *conn,
+				 unsigned n, char **lines),
+		 bool (*send)(struct mpd_connection *conn, char *line));
+
 void
 pretty_print_song(const struct mpd_song *song);
 
+/**
+ * Print a UTF-8 string in the locale charset, followed by a newline.
+ *
+ * @param buffer a scratch buffer for the conversion, which should be
+ * reused for all lines printed by a loop
+ */
+void
+print_utf8_line(struct mpc_buffer *buffer, const char *s);
+
 /**
  * @param pretty pretty-print songs (with the song format) or print
  * just the URI?
@@ -50,6 +224,34 @@ void
 print_entity_list(struct mpd_connection *c, enum mpd_entity_type filter_type,
 		  bool pretty);
 
+/**
+ * Print the songs in the range specified by "--range", fetching them
+ * in windows of "--page-size" songs.  The request for each window is
+ * sent before the previous one is printed; the last window is printed
+ * while it is received.
+ *
+ * @param send sends the request for the songs in [start, end), and
+ * returns false on error; the window is the whole list if start is 0
+ * and end is UINT_MAX; #first is true for the first window
+ * @param pretty pretty-print songs (with the song format) or print
+ * just the URI?
+ * @return false if the first send() has failed without a connection
+ * error (it has printed a message then)
+ */
+bool
+print_song_pages(struct mpd_connection *conn,
+		 bool (*send)(struct mpd_connection *conn,
+			      unsigned start, unsigned end, bool first,
+			      void *ctx),
+		 void *ctx, bool pretty);
+
+/**
+ * Receive a list of songs and print those in the range specified by
+ * "--range".  This is for responses which cannot be limited by MPD.
+ */
+void
+print_song_range(struct mpd_connection *conn, bool pretty);
+
 void
 print_filenames(struct mpd_connection *conn);
 
@@ -0,0 +1,21 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "writer.h"
+
+#include <unistd.h>
+
+#if STDOUT_BUFFER_SIZE > 0
+static char stdout_buffer[STDOUT_BUFFER_SIZE];
+#endif
+
+void
+writer_init(void)
+{
+#if STDOUT_BUFFER_SIZE > 0
+	/* keep the default line buffering on a terminal, so
+	   interactive output appears immediately */
+	if (!isatty(STDOUT_FILENO))
+		setvbuf(stdout, stdout_buffer, _IOFBF, sizeof(stdout_buffer));
+#endif
+}
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef MPC_WRITER_H
+#define MPC_WRITER_H
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * The output layer for bulk listings.  It writes to stdout, so it
+ * can be mixed freely with printf(), but it bypasses stdio's
+ * per-call locking (only the main thread writes to stdout; the
+ * "--trace" thread never does) and gives stdout a large block buffer
+ * when it is not a terminal.  The buffer is flushed when it is full,
+ * at exit and by writer_flush(), which must be called before waiting
+ * for the server.
+ */
+
+/**
+ * Install the stdout buffer.  Call this once, before anything is
+ * written to stdout.
+ */
+void
+writer_init(void);
+
+static inline void
+writer_write(const char *p, size_t length)
+{
+#ifdef HAVE_FWRITE_UNLOCKED
+	fwrite_unlocked(p, 1, length, stdout);
+#else
+	fwrite(p, 1, length, stdout);
+#endif
+}
+
+static inline void
+writer_putc(char ch)
+{
+#ifdef HAVE_PUTC_UNLOCKED
+	putc_unlocked(ch, stdout);
+#else
+	putc(ch, stdout);
+#endif
+}
+
+static inline void
+writer_puts(const char *s)
+{
+	writer_write(s, strlen(s));
+}
+
+/**
+ * Write a string followed by a newline.
+ */
+static inline void
+writer_line(const char *s)
+{
+	writer_puts(s);
+	writer_putc('\n');
+}
+
+static inline void
+writer_flush(void)
+{
+	fflush(stdout);
+}
+
+#endif
@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+/*
+ * Binary output benchmark: measures the throughput of "mpc
+ * readpicture" for a large picture served by a fake MPD server on a
+ * local socket, with stdout being a pipe and a regular file.
+ *
+ * Usage: bench_binary /path/to/mpc
+ */
+
+#include "fake_mpd.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+enum {
+	N_ROUNDS = 20,
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static pid_t
+spawn_mpc(char *mpc, int stdout_fd)
+{
+	const pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork() failed");
+		exit(EXIT_FAILURE);
+	}
+
+	if (pid == 0) {
+		static char readpicture[] = "readpicture";
+		static char uri[] = "Some Artist/Some Album/01 - Song.flac";
+		char *argv[] = { mpc, readpicture, uri, NULL };
+
+		dup2(stdout_fd, STDOUT_FILENO);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	return pid;
+}
+
+static void
+wait_mpc(pid_t pid)
+{
+	int status;
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "mpc readpicture failed\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Run mpc once with stdout connected to a pipe, and drain it.
+ */
+static void
+run_pipe(char *mpc)
+{
+	int fds[2];
+	if (pipe(fds) < 0) {
+		perror("pipe() failed");
+		exit(EXIT_FAILURE);
+	}
+
+	const pid_t pid = spawn_mpc(mpc, fds[1]);
+	close(fds[1]);
+
+	static char buffer[65536];
+	size_t total = 0;
+	ssize_t nbytes;
+	while ((nbytes = read(fds[0], buffer, sizeof(buffer))) > 0)
+		total += nbytes;
+
+	close(fds[0]);
+	wait_mpc(pid);
+
+	if (total != FAKE_MPD_PICTURE_SIZE) {
+		fprintf(stderr, "Received %zu bytes instead of %u\n",
+			total, (unsigned)FAKE_MPD_PICTURE_SIZE);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Run mpc once with stdout redirected to a regular file.
+ */
+static void
+run_file(char *mpc, const char *path)
+{
+	const int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+	if (fd < 0) {
+		perror("Failed to create file");
+		exit(EXIT_FAILURE);
+	}
+
+	const pid_t pid = spawn_mpc(mpc, fd);
+	close(fd);
+	wait_mpc(pid);
+}
+
+static void
+report(const char *name, double total, double best)
+{
+	const double mb = FAKE_MPD_PICTURE_SIZE / 1e6;
+	printf("%8.1f MB/s avg %8.1f MB/s max  %s\n",
+	       mb * N_ROUNDS / total * 1e6, mb / best * 1e6, name);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s MPC\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	char *mpc = argv[1];
+
+	char directory[] = "/tmp/bench_binary_XXXXXX";
+	if (mkdtemp(directory) == NULL) {
+		perror("mkdtemp() failed");
+		return EXIT_FAILURE;
+	}
+
+	char path[64], output_path[64];
+	snprintf(path, sizeof(path), "%s/mpd", directory);
+	snprintf(output_path, sizeof(output_path), "%s/picture", directory);
+
+	const pid_t mpd_pid = start_fake_mpd(path);
+
+	setenv("MPD_HOST", path, 1);
+	unsetenv("MPD_PORT");
+	unsetenv("MPC_TRACE");
+	unsetenv("MPC_ART_CACHE");
+
+	double total = 0, best = 1e12;
+	for (unsigned round = 0; round <= N_ROUNDS; ++round) {
+		const double start = now();
+		run_pipe(mpc);
+		const double duration = now() - start;
+
+		/* the first round warms up the page cache */
+		if (round > 0) {
+			total += duration;
+			if (duration < best)
+				best = duration;
+		}
+	}
+
+	report("pipe", total, best);
+
+	total = 0;
+	best = 1e12;
+	for (unsigned round = 0; round <= N_ROUNDS; ++round) {
+		const double start = now();
+		run_file(mpc, output_path);
+		const double duration = now() - start;
+
+		if (round > 0) {
+			total += duration;
+			if (duration < best)
+				best = duration;
+		}
+	}
+
+	report("file", total, best);
+
+	kill(mpd_pid, SIGTERM);
+	waitpid(mpd_pid, NULL, 0);
+
+	unlink(output_path);
+	unlink(path);
+	rmdir(directory);
+
+	return EXIT_SUCCESS;
+}
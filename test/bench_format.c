@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+/*
+ * Microbenchmark for the format engine: measures the throughput of
+ * format_song() and format_status() on synthetic objects.
+ */
+
+#include "construct_song.h"
+#include "song_format.h"
+#include "status_format.h"
+
+#include <mpd/client.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef COUNT_ALLOCATIONS
+
+/* the benchmark is linked with "-Wl,--wrap=..." for these */
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t n, size_t size);
+void *__wrap_realloc(void *p, size_t size);
+
+static unsigned long n_allocations;
+
+void *
+__wrap_malloc(size_t size)
+{
+	++n_allocations;
+	return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t n, size_t size)
+{
+	++n_allocations;
+	return __real_calloc(n, size);
+}
+
+void *
+__wrap_realloc(void *p, size_t size)
+{
+	++n_allocations;
+	return __real_realloc(p, size);
+}
+
+static unsigned long
+allocation_count(void)
+{
+	return n_allocations;
+}
+
+#else
+
+static unsigned long
+allocation_count(void)
+{
+	return 0;
+}
+
+#endif
+
+enum {
+	N_SONGS = 1000,
+	N_ROUNDS = 200,
+};
+
+static const char *const song_formats[] = {
+	/* the default song format */
+	"[%name%: &[%artist% - ]%title%]|%name%|[%artist% - ]%title%|%file%",
+
+	"[[%albumartist%|%artist%] - ][%album% - ][[%disc%.]%track% ]"
+	"[%title%|%file%][ (%time%)]",
+
+	"[%position%. ][[%artist%|%performer%|%composer%] - ]"
+	"[[%album%] [(%date%) ]- ]%title%|[%name%: &%file%]"
+	"[\\t[%genre%&%label%]][\\t%audioformat%][\\t%mtime%]",
+
+	NULL
+};
+
+static const char *const status_formats[] = {
+	/* the default status format */
+	"[%state%] #%songpos%/%length% %currenttime%/%totaltime% (%percenttime%)",
+
+	"volume:%volume% repeat:%repeat% random:%random% single:%single% "
+	"consume:%consume%[ %kbitrate%kbps][ %audioformat%]",
+
+	NULL
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static struct mpd_song *
+construct_bench_song(unsigned i)
+{
+	char file[64], track[16], disc[16], date[16];
+	snprintf(file, sizeof(file), "Some Artist/Some Album/%02u - Song %u.flac",
+		 i % 20 + 1, i);
+	snprintf(track, sizeof(track), "%u", i % 20 + 1);
+	snprintf(disc, sizeof(disc), "%u", i % 3 + 1);
+	snprintf(date, sizeof(date), "%u", 1960 + i % 60);
+
+	struct mpd_song *song =
+		construct_song(file,
+			       "Artist", "Some Artist",
+			       "AlbumArtist", "Some Artist",
+			       "Album", "Some Album With A Longer Name",
+			       "Title", "A Song Title Of Average Length",
+			       "Track", track,
+			       "Disc", disc,
+			       "Date", date,
+			       "Genre", "Rock",
+			       "Composer", "Somebody Else",
+			       "Label", "Records Inc.",
+			       "Time", "243",
+			       "Format", "44100:16:2",
+			       NULL);
+
+	/* every fourth song has several artists */
+	if (i % 4 == 0) {
+		feed_song(song, "Artist", "Featured Artist");
+		feed_song(song, "Artist", "Another Featured Artist");
+	}
+
+	/* some streams have only a name */
+	if (i % 10 == 0)
+		feed_song(song, "Name", "Radio Station");
+
+	return song;
+}
+
+static void
+feed_status(struct mpd_status *status, const char *name, const char *value)
+{
+	const struct mpd_pair pair = { name, value };
+	mpd_status_feed(status, &pair);
+}
+
+static struct mpd_status *
+construct_bench_status(void)
+{
+	struct mpd_status *status = mpd_status_begin();
+	feed_status(status, "volume", "75");
+	feed_status(status, "repeat", "0");
+	feed_status(status, "random", "1");
+	feed_status(status, "single", "0");
+	feed_status(status, "consume", "0");
+	feed_status(status, "playlistlength", "1234");
+	feed_status(status, "state", "play");
+	feed_status(status, "song", "42");
+	feed_status(status, "songid", "43");
+	feed_status(status, "time", "61:243");
+	feed_status(status, "elapsed", "61.234");
+	feed_status(status, "bitrate", "912");
+	feed_status(status, "audio", "44100:16:2");
+	return status;
+}
+
+static void
+report(const char *kind, const char *format, double ns, unsigned long n,
+       unsigned long allocations)
+{
+	printf("%-6s %10.1f ns", kind, ns / n);
+#ifdef COUNT_ALLOCATIONS
+	printf(" %6.2f allocs", (double)allocations / n);
+#else
+	(void)allocations;
+#endif
+	printf("  %.60s\n", format);
+}
+
+static void
+bench_songs(struct mpd_song *const*songs, const char *format)
+{
+	/* warm up the template cache */
+	free(format_song(songs[0], format));
+
+	const unsigned long allocations = allocation_count();
+	const double start = now();
+
+	for (unsigned round = 0; round < N_ROUNDS; ++round)
+		for (unsigned i = 0; i < N_SONGS; ++i)
+			free(format_song(songs[i], format));
+
+	const double ns = now() - start;
+	report("song", format, ns, (unsigned long)N_ROUNDS * N_SONGS,
+	       allocation_count() - allocations);
+}
+
+static void
+bench_status(const struct mpd_status *status, const char *format)
+{
+	free(format_status(status, format));
+
+	const unsigned long allocations = allocation_count();
+	const double start = now();
+
+	for (unsigned i = 0; i < N_ROUNDS * N_SONGS; ++i)
+		free(format_status(status, format));
+
+	const double ns = now() - start;
+	report("status", format, ns, (unsigned long)N_ROUNDS * N_SONGS,
+	       allocation_count() - allocations);
+}
+
+int
+main(void)
+{
+	struct mpd_song **songs = malloc(N_SONGS * sizeof(*songs));
+	for (unsigned i = 0; i < N_SONGS; ++i)
+		songs[i] = construct_bench_song(i);
+
+	for (const char *const*f = song_formats; *f != NULL; ++f)
+		bench_songs(songs, *f);
+
+	struct mpd_status *status = construct_bench_status();
+
+	for (const char *const*f = status_formats; *f != NULL; ++f)
+		bench_status(status, *f);
+
+	mpd_status_free(status);
+
+	for (unsigned i = 0; i < N_SONGS; ++i)
+		mpd_song_free(songs[i]);
+	free(songs);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+/*
+ * Startup benchmark: measures the time from fork() until the exit of
+ * an mpc process running a short command (the kind bound to a
+ * hotkey) against a minimal fake MPD server on a local socket.
+ *
+ * Usage: bench_startup /path/to/mpc
+ */
+
+#include "fake_mpd.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+enum {
+	N_ROUNDS = 200,
+};
+
+/**
+ * The mpc arguments, separated by spaces.
+ */
+static const char *const commands[] = {
+	"-q next",
+	"-q volume 50",
+	"-q next ; play",
+	"status",
+	"current",
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/**
+ * Run mpc once and wait for it to exit.
+ */
+static void
+run_mpc(char *const*argv)
+{
+	const pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork() failed");
+		exit(EXIT_FAILURE);
+	}
+
+	if (pid == 0) {
+		const int null_fd = open("/dev/null", O_WRONLY);
+		dup2(null_fd, STDOUT_FILENO);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+
+	int status;
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "%s %s failed\n", argv[0], argv[1]);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void
+bench_command(char *mpc, const char *command)
+{
+	char buffer[64];
+	snprintf(buffer, sizeof(buffer), "%s", command);
+
+	char *argv[8] = { mpc };
+	unsigned argc = 1;
+	for (char *p = strtok(buffer, " "); p != NULL && argc < 7;
+	     p = strtok(NULL, " "))
+		argv[argc++] = p;
+
+	/* warm up the page cache */
+	run_mpc(argv);
+
+	double total = 0, best = 1e12;
+
+	for (unsigned round = 0; round < N_ROUNDS; ++round) {
+		const double start = now();
+		run_mpc(argv);
+		const double duration = now() - start;
+
+		total += duration;
+		if (duration < best)
+			best = duration;
+	}
+
+	printf("%8.1f us avg %8.1f us min  %s\n",
+	       total / N_ROUNDS, best, command);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s MPC\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	char *mpc = argv[1];
+
+	char directory[] = "/tmp/bench_startup_XXXXXX";
+	if (mkdtemp(directory) == NULL) {
+		perror("mkdtemp() failed");
+		return EXIT_FAILURE;
+	}
+
+	char path[64];
+	snprintf(path, sizeof(path), "%s/mpd", directory);
+
+	const pid_t mpd_pid = start_fake_mpd(path);
+
+	setenv("MPD_HOST", path, 1);
+	unsetenv("MPD_PORT");
+	unsetenv("MPC_FORMAT");
+	unsetenv("MPC_TRACE");
+
+	for (unsigned i = 0; i < sizeof(commands) / sizeof(commands[0]); ++i)
+		bench_command(mpc, commands[i]);
+
+	kill(mpd_pid, SIGTERM);
+	waitpid(mpd_pid, NULL, 0);
+
+	unlink(path);
+	rmdir(directory);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef MPC_TEST_CONSTRUCT_SONG_H
+#define MPC_TEST_CONSTRUCT_SONG_H
+
+#include <mpd/client.h>
+
+#include <assert.h>
+#include <stdarg.h>
+
+static inline void
+feed_song(struct mpd_song *song, const char *name, const char *value)
+{
+	const struct mpd_pair pair = { name, value };
+	mpd_song_feed(song, &pair);
+}
+
+/**
+ * Construct a song object from a URI and a NULL-terminated list of
+ * name/value pairs.
+ */
+static inline struct mpd_song *
+construct_song(const char *file, ...)
+{
+	const struct mpd_pair pair = { "file", file };
+	struct mpd_song *song = mpd_song_begin(&pair);
+	assert(song != NULL);
+
+	va_list ap;
+	va_start(ap, file);
+	const char *name;
+	while ((name = va_arg(ap, const char *)) != NULL) {
+		const char *value = va_arg(ap, const char *);
+		assert(value != NULL);
+		feed_song(song, name, value);
+	}
+	va_end(ap);
+
+	return song;
+}
+
+#endif
@@ -0,0 +1,291 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#include "fake_mpd.h"
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+enum {
+	/**
+	 * The maximum number of commands in a command list.
+	 */
+	MAX_LIST_LENGTH = 16,
+
+	MAX_LINE_LENGTH = 256,
+};
+
+/**
+ * The chunk size before "binarylimit"; this is MPD's default.
+ */
+static unsigned long binary_limit = 8192;
+
+/**
+ * The enabled tag types of this session, as a space-separated list
+ * or "all".
+ */
+static char tagtypes[MAX_LINE_LENGTH] = "all";
+
+static char *picture;
+
+static bool
+read_line(FILE *file, char *buffer, size_t size)
+{
+	if (fgets(buffer, size, file) == NULL)
+		return false;
+
+	buffer[strcspn(buffer, "\n")] = 0;
+	return true;
+}
+
+/**
+ * Is this tag enabled with "tagtypes"?
+ */
+static bool
+tag_enabled(const char *name)
+{
+	if (strcmp(tagtypes, "all") == 0)
+		return true;
+
+	const size_t length = strlen(name);
+	for (const char *p = tagtypes; (p = strstr(p, name)) != NULL;
+	     p += length)
+		if ((p == tagtypes || p[-1] == ' ') &&
+		    (p[length] == 0 || p[length] == ' '))
+			return true;
+
+	return false;
+}
+
+/**
+ * Write a tag of a song, unless it is disabled with "tagtypes".
+ */
+static void
+fake_mpd_tag(FILE *file, const char *name, const char *value)
+{
+	if (tag_enabled(name))
+		fprintf(file, "%s: %s\n", name, value);
+}
+
+/**
+ * Handle "tagtypes" (with or without quoted arguments).
+ */
+static void
+fake_mpd_tagtypes(FILE *file, const char *line)
+{
+	/* libmpdclient quotes the arguments, test_proxy doesn't */
+	char args[MAX_LINE_LENGTH];
+	size_t length = 0;
+	for (const char *p = line + 8; *p != 0; ++p)
+		if (*p != '"')
+			args[length++] = *p;
+	args[length] = 0;
+
+	if (length == 0)
+		fprintf(file, "tagtype: %s\n", tagtypes);
+	else if (strcmp(args, " all") == 0)
+		strcpy(tagtypes, "all");
+	else if (strcmp(args, " clear") == 0)
+		tagtypes[0] = 0;
+	else if (strncmp(args, " enable ", 8) == 0) {
+		const size_t n = strlen(tagtypes);
+		snprintf(tagtypes + n, sizeof(tagtypes) - n,
+			 "%s%s", n > 0 ? " " : "", args + 8);
+	}
+}
+
+/**
+ * Write one chunk of the picture.
+ */
+static void
+fake_mpd_picture(FILE *file, unsigned long offset)
+{
+	unsigned long size = offset < FAKE_MPD_PICTURE_SIZE
+		? FAKE_MPD_PICTURE_SIZE - offset : 0;
+	if (size > binary_limit)
+		size = binary_limit;
+
+	fprintf(file, "size: %u\ntype: image/jpeg\nbinary: %lu\n",
+		(unsigned)FAKE_MPD_PICTURE_SIZE, size);
+	fwrite(picture + offset, 1, size, file);
+	fputc('\n', file);
+}
+
+/**
+ * Write the response of one command without the final "OK".
+ *
+ * @return false if the command has failed
+ */
+static bool
+fake_mpd_command(FILE *in, FILE *out, const char *line)
+{
+	unsigned long value;
+
+	if (strcmp(line, "status") == 0)
+		fputs("volume: 50\nrepeat: 0\nrandom: 0\nsingle: 0\n"
+		      "consume: 0\nplaylistlength: 10\nstate: play\n"
+		      "song: 3\nsongid: 4\ntime: 61:243\nelapsed: 61.234\n"
+		      "bitrate: 912\naudio: 44100:16:2\n", out);
+	else if (strcmp(line, "currentsong") == 0) {
+		fputs("file: Some Artist/Some Album/04 - Song.flac\n", out);
+		fake_mpd_tag(out, "Artist", "Some Artist");
+		fake_mpd_tag(out, "Album", "Some Album");
+		fake_mpd_tag(out, "Title", "A Song Title");
+		fputs("Time: 243\nPos: 3\nId: 4\n", out);
+	}
+	else if (strncmp(line, "password ", 9) == 0)
+		return strcmp(line + 9, "\"" FAKE_MPD_PASSWORD "\"") == 0;
+	else if (strcmp(line, "whoami") == 0)
+		fprintf(out, "pid: %d\n", (int)getpid());
+	else if (strcmp(line, "binary") == 0)
+		fprintf(out, "size: %zu\nbinary: %zu\n%s\n",
+			sizeof(FAKE_MPD_BINARY_PAYLOAD) - 1,
+			sizeof(FAKE_MPD_BINARY_PAYLOAD) - 1,
+			FAKE_MPD_BINARY_PAYLOAD);
+	else if (strcmp(line, "tagtypes") == 0 ||
+		 strncmp(line, "tagtypes ", 9) == 0)
+		fake_mpd_tagtypes(out, line);
+	else if (strcmp(line, "idle") == 0) {
+		/* wait for "noidle" */
+		char noidle[MAX_LINE_LENGTH];
+		fflush(out);
+		return read_line(in, noidle, sizeof(noidle));
+	} else if (sscanf(line, "binarylimit \"%lu\"", &value) == 1)
+		binary_limit = value;
+	else if (sscanf(line, "albumart \"%*[^\"]\" \"%lu\"", &value) == 1 ||
+		 sscanf(line, "readpicture \"%*[^\"]\" \"%lu\"", &value) == 1)
+		fake_mpd_picture(out, value);
+
+	return true;
+}
+
+/**
+ * Execute a command list after "command_list_end".
+ */
+static void
+fake_mpd_command_list(FILE *in, FILE *out,
+		      char list[][MAX_LINE_LENGTH], unsigned length,
+		      bool list_ok)
+{
+	for (unsigned i = 0; i < length; ++i) {
+		if (!fake_mpd_command(in, out, list[i])) {
+			fprintf(out, "ACK [3@%u] {} command failed\n", i);
+			return;
+		}
+
+		if (list_ok)
+			fputs("list_OK\n", out);
+	}
+
+	fputs("OK\n", out);
+}
+
+static void
+fake_mpd_session(int fd)
+{
+	/* separate streams, because a stdio stream must not switch
+	   from writing to reading without flushing */
+	FILE *in = fdopen(fd, "r"), *out = fdopen(dup(fd), "w");
+	char line[MAX_LINE_LENGTH];
+	char list[MAX_LIST_LENGTH][MAX_LINE_LENGTH];
+	unsigned list_length = 0;
+	bool in_list = false, list_ok = false;
+
+	fputs("OK MPD 0.23.5\n", out);
+	fflush(out);
+
+	while (read_line(in, line, sizeof(line))) {
+		if (strcmp(line, "command_list_begin") == 0 ||
+		    strcmp(line, "command_list_ok_begin") == 0) {
+			in_list = true;
+			list_ok = line[13] == 'o';
+			list_length = 0;
+			continue;
+		}
+
+		if (in_list && strcmp(line, "command_list_end") != 0) {
+			if (list_length < MAX_LIST_LENGTH)
+				strcpy(list[list_length++], line);
+			continue;
+		}
+
+		if (in_list) {
+			in_list = false;
+			fake_mpd_command_list(in, out, list, list_length,
+					      list_ok);
+		} else if (fake_mpd_command(in, out, line))
+			fputs("OK\n", out);
+		else
+			fprintf(out, "ACK [3@0] {} command failed\n");
+
+		fflush(out);
+	}
+
+	fclose(out);
+	fclose(in);
+}
+
+pid_t
+start_fake_mpd(const char *path)
+{
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	strcpy(address.sun_path, path);
+
+	const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0 ||
+	    bind(listen_fd, (const struct sockaddr *)&address,
+		 sizeof(address)) < 0 ||
+	    listen(listen_fd, 4) < 0) {
+		perror("Failed to listen");
+		exit(EXIT_FAILURE);
+	}
+
+	const pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork() failed");
+		exit(EXIT_FAILURE);
+	}
+
+	if (pid > 0) {
+		close(listen_fd);
+		return pid;
+	}
+
+#ifdef __linux__
+	/* don't outlive a test which has failed */
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+
+	picture = malloc(FAKE_MPD_PICTURE_SIZE);
+	for (unsigned i = 0; i < FAKE_MPD_PICTURE_SIZE; ++i)
+		picture[i] = (char)(i * 7);
+
+	/* reap the sessions */
+	signal(SIGCHLD, SIG_IGN);
+
+	/* each session gets its own process, so its state is private
+	   and "whoami" tells the sessions apart */
+	while (true) {
+		const int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0)
+			continue;
+
+		if (fork() == 0) {
+			close(listen_fd);
+			fake_mpd_session(fd);
+			_exit(EXIT_SUCCESS);
+		}
+
+		close(fd);
+	}
+}
@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright The Music Player Daemon Project
+
+#ifndef MPC_TEST_FAKE_MPD_H
+#define MPC_TEST_FAKE_MPD_H
+
+#include <sys/types.h>
+
+enum {
+	/**
+	 * The size of the picture returned by "albumart" and
+	 * "readpicture" for any URI.
+	 */
+	FAKE_MPD_PICTURE_SIZE = 16 * 1024 * 1024,
+};
+
+/**
+ * The only password accepted by "password".
+ */
+#define FAKE_MPD_PASSWORD "secret"
+
+/**
+ * The payload of the "binary" test command; it contains "OK" lines
+ * which must not be mistaken for the end of the response.
+ */
+#define FAKE_MPD_BINARY_PAYLOAD "OK\n\n\n"
+
+/**
+ * Fork a minimal fake MPD server listening on a Unix socket.  Each
+ * connection is handled by a separate process.  It answers
+ * "status", "currentsong", "binarylimit", "albumart",
+ * "readpicture", "password", "tagtypes" (which "currentsong"
+ * respects), "idle", command lists, and
+ * the test commands "whoami" (the process id of the session) and
+ * "binary"; all other commands just get "OK".
+ *
+ * @return the process id; stop it with SIGTERM
+ */
+pid_t
+start_fake_mpd(const char *path);
+
+#endif
@@ -0,0 +1,115 @@
+#include "args.h"
+
+#include <check.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+START_TEST(test_split_chunks)
+{
+	FILE *file = tmpfile();
+	ck_assert_ptr_nonnull(file);
+
+	const unsigned n = LINE_CHUNK_LINES * 2 + 10;
+	for (unsigned i = 0; i < n; ++i)
+		fprintf(file, "line %u\n", i);
+	rewind(file);
+
+	struct line_reader reader;
+	line_reader_init(&reader, file);
+
+	struct line_chunk chunk;
+	line_chunk_init(&chunk);
+
+	unsigned total = 0, n_chunks = 0;
+	while (line_reader_read(&reader, &chunk) > 0) {
+		ck_assert_uint_le(chunk.n_lines, LINE_CHUNK_LINES);
+		ck_assert_uint_eq(chunk.first_line, total + 1);
+
+		for (unsigned i = 0; i < chunk.n_lines; ++i) {
+			char expected[32];
+			snprintf(expected, sizeof(expected), "line %u",
+				 total + i);
+			ck_assert_str_eq(chunk.lines[i], expected);
+		}
+
+		total += chunk.n_lines;
+		++n_chunks;
+	}
+
+	ck_assert_uint_eq(total, n);
+	ck_assert_uint_eq(n_chunks, 3);
+
+	line_chunk_deinit(&chunk);
+	line_reader_deinit(&reader);
+	fclose(file);
+}
+END_TEST
+
+START_TEST(test_long_line)
+{
+	FILE *file = tmpfile();
+	ck_assert_ptr_nonnull(file);
+
+	/* longer than a chunk, without a final newline */
+	const size_t length = LINE_CHUNK_BYTES * 2;
+	char *long_line = malloc(length + 1);
+	memset(long_line, 'x', length);
+	long_line[length] = 0;
+
+	fprintf(file, "short\n%s", long_line);
+	rewind(file);
+
+	struct line_reader reader;
+	line_reader_init(&reader, file);
+
+	struct line_chunk chunk;
+	line_chunk_init(&chunk);
+
+	ck_assert_uint_eq(line_reader_read(&reader, &chunk), 2);
+	ck_assert_str_eq(chunk.lines[0], "short");
+	ck_assert_str_eq(chunk.lines[1], long_line);
+	ck_assert_uint_eq(line_reader_read(&reader, &chunk), 0);
+
+	line_chunk_deinit(&chunk);
+	line_reader_deinit(&reader);
+	fclose(file);
+	free(long_line);
+}
+END_TEST
+
+START_TEST(test_stdin_argument)
+{
+	char dash[] = "-", other[] = "foo";
+	char *argv[] = { dash, other };
+
+	ck_assert(is_stdin_argument(1, argv));
+	ck_assert(!is_stdin_argument(2, argv));
+	ck_assert(!is_stdin_argument(1, argv + 1));
+	ck_assert(!is_stdin_argument(0, argv));
+}
+END_TEST
+
+static Suite *
+create_suite(void)
+{
+	Suite *s = suite_create("args");
+	TCase *tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, test_split_chunks);
+	tcase_add_test(tc_core, test_long_line);
+	tcase_add_test(tc_core, test_stdin_argument);
+	suite_add_tcase(s, tc_core);
+	return s;
+}
+
+int
+main(void)
+{
+	Suite *s = create_suite();
+	SRunner *sr = srunner_create(s);
+	srunner_run_all(sr, CK_NORMAL);
+	int number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,127 @@
+#include "charset.h"
+#include "buffer.h"
+
+#include <check.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const ascii = "foo bar baz, the quick brown fox";
+static const char *const latin = "b\xc3\xa4z";
+
+START_TEST(test_utf8_locale)
+{
+	setenv("LC_ALL", "C.UTF-8", 1);
+	charset_init(true, true);
+
+	const unsigned open_count = charset_open_count();
+
+	/* identity conversion: the input is returned as-is */
+	for (unsigned i = 0; i < 16; ++i) {
+		ck_assert_ptr_eq(charset_to_utf8(ascii), ascii);
+		ck_assert_ptr_eq(charset_from_utf8(ascii), ascii);
+		ck_assert_ptr_eq(charset_to_utf8(latin), latin);
+		ck_assert_ptr_eq(charset_from_utf8(latin), latin);
+	}
+
+	ck_assert_uint_eq(charset_open_count(), open_count);
+
+	charset_deinit();
+}
+END_TEST
+
+START_TEST(test_ascii_locale)
+{
+	setenv("LC_ALL", "C", 1);
+	charset_init(true, true);
+
+	const unsigned open_count = charset_open_count();
+
+	/* pure ASCII needs no conversion */
+	ck_assert_ptr_eq(charset_to_utf8(ascii), ascii);
+	ck_assert_ptr_eq(charset_from_utf8(ascii), ascii);
+	ck_assert_uint_eq(charset_open_count(), open_count);
+
+	for (unsigned i = 0; i < 16; ++i) {
+		charset_to_utf8(latin);
+		charset_from_utf8(latin);
+		ck_assert_str_eq(charset_to_utf8(ascii), ascii);
+	}
+
+	/* one descriptor per direction, never reopened */
+	ck_assert_uint_eq(charset_open_count(), open_count + 2);
+
+	charset_deinit();
+}
+END_TEST
+
+START_TEST(test_buffer)
+{
+	setenv("LC_ALL", "C", 1);
+	charset_init(true, true);
+
+	struct mpc_buffer buffer;
+	mpc_buffer_init(&buffer);
+	mpc_buffer_append(&buffer, "x", 1);
+
+	ck_assert_ptr_eq(charset_from_utf8_buffer(&buffer, ascii,
+						  strlen(ascii)),
+			 ascii);
+
+	/* not representable in ASCII: the input is returned and the
+	   buffer is left unmodified */
+	ck_assert_ptr_eq(charset_from_utf8_buffer(&buffer, latin,
+						  strlen(latin)),
+			 latin);
+	ck_assert_uint_eq(buffer.length, 1);
+	ck_assert_str_eq(buffer.data, "x");
+
+	mpc_buffer_deinit(&buffer);
+	charset_deinit();
+}
+END_TEST
+
+START_TEST(test_lazy)
+{
+	setenv("LC_ALL", "C", 1);
+	charset_init(true, true);
+
+	ck_assert_ptr_eq(charset_to_utf8(ascii), ascii);
+	ck_assert_ptr_eq(charset_from_utf8(ascii), ascii);
+
+	/* the locale has not been looked at yet, so this change takes
+	   effect */
+	setenv("LC_ALL", "C.UTF-8", 1);
+
+	const unsigned open_count = charset_open_count();
+	ck_assert_ptr_eq(charset_to_utf8(latin), latin);
+	ck_assert_ptr_eq(charset_from_utf8(latin), latin);
+	ck_assert_uint_eq(charset_open_count(), open_count);
+
+	charset_deinit();
+}
+END_TEST
+
+static Suite *
+create_suite(void)
+{
+	Suite *s = suite_create("charset");
+	TCase *tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, test_utf8_locale);
+	tcase_add_test(tc_core, test_ascii_locale);
+	tcase_add_test(tc_core, test_buffer);
+	tcase_add_test(tc_core, test_lazy);
+	suite_add_tcase(s, tc_core);
+	return s;
+}
+
+int
+main(void)
+{
+	Suite *s = create_suite();
+	SRunner *sr = srunner_create(s);
+	srunner_run_all(sr, CK_NORMAL);
+	int number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+	return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,38 +1,13 @@
+#include "construct_song.h"
 #include "song_format.h"
+#include "buffer.h"
 
 #include <mpd/client.h>
 
 #include <check.h>
 
-#include <assert.h>
 #include <stdlib.h>
-#include <stdarg.h>
-
-static void
-feed_song(struct mpd_song *song, const char *name, const char *value)
-{
-	const struct mpd_pair pair = { name, value };
-	mpd_song_feed(song, &pair);
-}
-
-static struct mpd_song *
-construct_song(const char *file, ...)
-{
-	const struct mpd_pair pair = { "file", file };
-	struct mpd_song *song = mpd_song_begin(&pair);
-	assert(song != NULL);
-
-	va_list ap;
-	va_start(ap, file);
-	const char *name;
-	while ((name = va_arg(ap, const char *)) != NULL) {
-		const char *value = va_arg(ap, const char *);
-		assert(value != NULL);
-		feed_song(song, name, value);
-	}
-
-	return song;
-}
+#include <string.h>
 
 static const char *const default_file = "foo.ogg";
 static const char *const default_artist = "Foo";
@@ -143,6 +118,119 @@ START_TEST(test_multi_artist)
 }
 END_TEST
 
+START_TEST(test_multi_value_long)
+{
+	/* the joined value is longer than any fixed buffer mpc used
+	   to have */
+	char value[200];
+	memset(value, 'x', sizeof(value) - 1);
+	value[sizeof(value) - 1] = 0;
+
+	struct mpd_song *song = construct_song(default_file,
+			      "Genre", value,
+			      "Genre", value,
+			      "Genre", "Opera",
+			      NULL);
+
+	char *p = format_song(song, "%genre%");
+	ck_assert_uint_eq(strlen(p), 2 * (sizeof(value) - 1) + 2 * 2 + 5);
+	ck_assert_str_eq(p + strlen(p) - 7, ", Opera");
+	free(p);
+
+	format_song_set_tag_separator(";");
+	p = format_song(song, "%genre%");
+	ck_assert_uint_eq(strlen(p), 2 * (sizeof(value) - 1) + 2 + 5);
+	ck_assert_str_eq(p + strlen(p) - 6, ";Opera");
+	free(p);
+	format_song_set_tag_separator(", ");
+
+	mpd_song_free(song);
+
+	song = construct_song(default_file,
+			      "Artist", "Foo",
+			      "Artist", "Bar",
+			      NULL);
+	format_song_set_tag_separator(" / ");
+	assert_format(song, "%artist%", "Foo / Bar");
+	format_song_set_tag_separator(", ");
+	mpd_song_free(song);
+}
+END_TEST
+
+START_TEST(test_nested)
+{
+	struct mpd_song *song = construct_default_song();
+	assert_format(song, "[[%albumartist%|%artist%] - [%album%|x]]", "Foo - ");
+	assert_format(song, "[%album%&%title%]|[%artist%&%title%]", "FooBar");
+	assert_format(song, "[[%album%]|[%genre%]]|%file%", default_file);
+	assert_format(song, "[%title%", "Bar");
+	assert_format(song, "%title%]%artist%", "Bar");
+	assert_format(song, "%bogus%", "%bogus%");
+	mpd_song_free(song);
+}
+END_TEST
+
+START_TEST(test_template_cache)
+{
+	struct mpd_song *song = construct_default_song();
+
+	/* cycle through more formats than the cache holds */
+	for (unsigned i = 0; i < 3; ++i) {
+		assert_format(song, "%file%", default_file);
+		assert_format(song, "%artist%", default_artist);
+		assert_format(song, "%title%", default_title);
+		assert_format(song, "[%artist% - ]%title%", "Foo - Bar");
+		assert_format(song, default_format, "Foo - Bar");
+		assert_format(song, "", NULL);
+	}
+
+	mpd_song_free(song);
+}
+END_TEST
+
+START_TEST(test_write)
+{
+	struct mpd_song *song = construct_default_song();
+
+	struct mpc_buffer buffer;
+	mpc_buffer_init(&buffer);
+
+	mpc_buffer_append(&buffer, "x", 1);
+	ck_assert(format_song_write(&buffer, song, "[%artist% - ]%title%"));
+	ck_assert_str_eq(buffer.data, "xFoo - Bar");
+	ck_assert_uint_eq(buffer.length, 10);
+
+	/* discarded output leaves the buffer unmodified */
+	ck_assert(!format_song_write(&buffer, song, "[%album%]|[%genre%]"));
+	ck_assert_str_eq(buffer.data, "xFoo - Bar");
+
+	mpc_buffer_clear(&buffer);
+	ck_assert(format_song_write(&buffer, song, "%albumartist%"));
+	ck_assert_str_eq(buffer.data, "");
+
+	mpc_buffer_deinit(&buffer);
+	mpd_song_free(song);
+}
+END_TEST
+
+START_TEST(test_attribute_mask)
+{
+	ck_assert(format_song_attribute_mask("") == 0);
+	ck_assert(format_song_attribute_mask("%bogus% foo") == 0);
+
+	/* attributes in sections which would be skipped count, too */
+	const uint64_t expected = ((uint64_t)1 << MPD_TAG_ARTIST) |
+		((uint64_t)1 << MPD_TAG_TITLE) |
+		((uint64_t)1 << MPD_TAG_NAME) |
+		((uint64_t)1 << SONG_ATTRIBUTE_FILE);
+	ck_assert(format_song_attribute_mask(default_format) == expected);
+
+	ck_assert(format_song_attribute_mask("[%time%|%audioformat%]") ==
+		  (((uint64_t)1 << SONG_ATTRIBUTE_TIME) |
+		   ((uint64_t)1 << SONG_ATTRIBUTE_AUDIOFORMAT)));
+}
+END_TEST
+
 static Suite *
 create_suite(void)
 {
@@ -155,6 +243,11 @@ create_suite(void)
 	tcase_add_test(tc_core, test_default);
 	tcase_add_test(tc_core, test_escape);
 	tcase_add_test(tc_core, test_multi_artist);
+	tcase_add_test(tc_core, test_multi_value_long);
+	tcase_add_test(tc_core, test_nested);
+	tcase_add_test(tc_core, test_template_cache);
+	tcase_add_test(tc_core, test_write);
+	tcase_add_test(tc_core, test_attribute_mask);
 	suite_add_tcase(s, tc_core);
 	return s;
 }
@@ -0,0 +1,192 @@
+#include "fake_mpd.h"
+
+#include <check.h>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char *mpc;
+static char directory[] = "/tmp/test_mpc_XXXXXX";
+static char mpd_path[64], batch_path[64];
+
+/**
+ * The output of the fake server's "currentsong" with the default
+ * format.
+ */
+static const char current_song[] = "Some Artist - A Song Title\n";
+
+/**
+ * Run mpc with the given arguments (NULL-terminated) and capture its
+ * stdout.
+ *
+ * @param input_path the file read from stdin
+ * @return the exit status
+ */
+static int
+run_mpc(const char *const*args, const char *input_path,
+	char *output, size_t size)
+{
+	const char *argv[16] = { mpc };
+	for (unsigned i = 0; args[i] != NULL; ++i)
+		argv[i + 1] = args[i];
+
+	int fds[2];
+	ck_assert_int_eq(pipe(fds), 0);
+
+	const pid_t pid = fork();
+	ck_assert_int_ge(pid, 0);
+
+	if (pid == 0) {
+		const int input_fd = open(input_path, O_RDONLY);
+		dup2(input_fd, STDIN_FILENO);
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		execv(mpc, (char *const*)argv);
+		_exit(127);
+	}
+
+	close(fds[1]);
+
+	size_t length = 0;
+	ssize_t nbytes;
+	while (length + 1 < size &&
+	       (nbytes = read(fds[0], output + length,
+			      size - 1 - length)) > 0)
+		length += nbytes;
+	output[length] = 0;
+	close(fds[0]);
+
+	int status;
+	ck_assert_int_eq(waitpid(pid, &status, 0), pid);
+	ck_assert(WIFEXITED(status));
+	return WEXITSTATUS(status);
+}
+
+static void
+write_batch(const char *lines)
+{
+	FILE *file = fopen(batch_path, "w");
+	ck_assert_ptr_nonnull(file);
+	fputs(lines, file);
+	fclose(file);
+}
+
+/**
+ * Run "mpc batch" with the given lines.
+ */
+static int
+run_batch(const char *lines, char *output, size_t size)
+{
+	write_batch(lines);
+
+	const char *const args[] = { "batch", batch_path, NULL };
+	return run_mpc(args, "/dev/null", output, size);
+}
+
+START_TEST(test_batch_tag_types)
+{
+	/* "search" disables the tags it does not print; "current"
+	   needs them again */
+	char output[256];
+	ck_assert_int_eq(run_batch("search any foo\ncurrent\n",
+				   output, sizeof(output)), 0);
+	ck_assert_str_eq(output, current_song);
+}
+END_TEST
+
+START_TEST(test_batch_bad_search)
+{
+	/* the bad search leaves its command list unfinished, which
+	   must not break the next line */
+	char output[256];
+	ck_assert_int_ne(run_batch("search nosuchtag foo\ncurrent\n",
+				   output, sizeof(output)), 0);
+	ck_assert_str_eq(output, current_song);
+}
+END_TEST
+
+START_TEST(test_batch_stdin)
+{
+	/* "add" without arguments reads stdin, which is the batch
+	   itself here */
+	write_batch("add\ncurrent\n");
+
+	const char *const args[] = { "batch", "-", NULL };
+	char output[256];
+	ck_assert_int_ne(run_mpc(args, batch_path, output, sizeof(output)),
+			 0);
+	ck_assert_str_eq(output, current_song);
+}
+END_TEST
+
+START_TEST(test_chain_tag_types)
+{
+	const char *const args[] = {
+		"search", "any", "foo", ";", "current", NULL
+	};
+	char output[256];
+	ck_assert_int_eq(run_mpc(args, "/dev/null", output, sizeof(output)),
+			 0);
+	ck_assert_str_eq(output, current_song);
+}
+END_TEST
+
+static Suite *
+create_suite(void)
+{
+	Suite *s = suite_create("mpc");
+	TCase *tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, test_batch_tag_types);
+	tcase_add_test(tc_core, test_batch_bad_search);
+	tcase_add_test(tc_core, test_batch_stdin);
+	tcase_add_test(tc_core, test_chain_tag_types);
+	suite_add_tcase(s, tc_core);
+	return s;
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s MPC\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	mpc = argv[1];
+
+	if (mkdtemp(directory) == NULL) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+
+	snprintf(mpd_path, sizeof(mpd_path), "%s/mpd", directory);
+	snprintf(batch_path, sizeof(batch_path), "%s/batch", directory);
+
+	const pid_t mpd_pid = start_fake_mpd(mpd_path);
+
+	setenv("MPD_HOST", mpd_path, 1);
+	unsetenv("MPD_PORT");
+	unsetenv("MPC_FORMAT");
+	unsetenv("MPC_TRACE");
+
+	Suite *s = create_suite();
+	SRunner *sr = srunner_create(s);
+	srunner_run_all(sr, CK_NORMAL);
+	int number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	kill(mpd_pid, SIGTERM);
+	waitpid(mpd_pid, NULL, 0);
+
+	unlink(batch_path);
+	unlink(mpd_path);
+	rmdir(directory);
+
+	return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,353 @@
+#include "proxy.h"
+#include "fake_mpd.h"
+
+#include <check.h>
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static char directory[] = "/tmp/test_proxy_XXXXXX";
+static char mpd_path[64], proxy_path[64], single_proxy_path[64];
+
+static const char binary_response[] =
+	"size: 5\nbinary: 5\n" FAKE_MPD_BINARY_PAYLOAD "\nOK\n";
+
+static void
+write_string(int fd, const char *s)
+{
+	const size_t length = strlen(s);
+	ck_assert_int_eq(write(fd, s, length), (ssize_t)length);
+}
+
+/**
+ * Read one line (without the newline) into the buffer.
+ *
+ * @return false on end of file
+ */
+static bool
+read_line(int fd, char *buffer, size_t size)
+{
+	size_t length = 0;
+	char ch;
+
+	while (read(fd, &ch, 1) == 1) {
+		if (ch == '\n') {
+			buffer[length] = 0;
+			return true;
+		}
+
+		if (length + 1 < size)
+			buffer[length++] = ch;
+	}
+
+	return false;
+}
+
+static int
+connect_to(const char *path)
+{
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	strcpy(address.sun_path, path);
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (const struct sockaddr *)&address,
+			      sizeof(address)) < 0)
+		return -1;
+
+	return fd;
+}
+
+/**
+ * @param pool_size the number of shared MPD connections; with only
+ * one, "whoami" tells whether a request has been sent over the shared
+ * connection
+ */
+static pid_t
+start_proxy(const char *path, unsigned pool_size)
+{
+	const int listen_fd = proxy_listen(path);
+	if (listen_fd < 0)
+		exit(EXIT_FAILURE);
+
+	const pid_t pid = fork();
+	if (pid < 0)
+		exit(EXIT_FAILURE);
+
+	if (pid > 0) {
+		close(listen_fd);
+		return pid;
+	}
+
+	const struct proxy_settings settings = {
+		.host = mpd_path,
+		.password = FAKE_MPD_PASSWORD,
+		.pool_size = pool_size,
+	};
+
+	_exit(proxy_run(listen_fd, &settings) == 0
+	      ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+static int
+connect_client_to(const char *path)
+{
+	const int fd = connect_to(path);
+	ck_assert_int_ge(fd, 0);
+
+	char line[256];
+	ck_assert(read_line(fd, line, sizeof(line)));
+	ck_assert_str_eq(line, "OK MPD 0.23.5");
+	return fd;
+}
+
+static int
+connect_client(void)
+{
+	return connect_client_to(proxy_path);
+}
+
+/**
+ * Connect to the proxy with only one shared MPD connection.
+ */
+static int
+connect_single_client(void)
+{
+	return connect_client_to(single_proxy_path);
+}
+
+static void
+expect_line(int fd, const char *expected)
+{
+	char line[256];
+	ck_assert(read_line(fd, line, sizeof(line)));
+	ck_assert_str_eq(line, expected);
+}
+
+static int
+whoami(int fd)
+{
+	char line[256];
+	write_string(fd, "whoami\n");
+	ck_assert(read_line(fd, line, sizeof(line)));
+	ck_assert(strncmp(line, "pid: ", 5) == 0);
+	expect_line(fd, "OK");
+	return atoi(line + 5);
+}
+
+START_TEST(test_simple)
+{
+	const int fd = connect_client();
+	write_string(fd, "ping\n");
+	expect_line(fd, "OK");
+	/* errors are forwarded */
+	write_string(fd, "password \"wrong\"\n");
+	expect_line(fd, "ACK [3@0] {} command failed");
+
+	/* the proxy has authenticated already */
+	write_string(fd, "password \"secret\"\n");
+	expect_line(fd, "OK");
+	write_string(fd, "partition \"default\"\n");
+	expect_line(fd, "OK");
+	close(fd);
+}
+END_TEST
+
+START_TEST(test_shared)
+{
+	int fd = connect_single_client();
+	const int pid = whoami(fd);
+	close(fd);
+
+	/* the next client gets the same MPD connection */
+	fd = connect_single_client();
+	ck_assert_int_eq(whoami(fd), pid);
+	close(fd);
+}
+END_TEST
+
+START_TEST(test_pipelined)
+{
+	int fds[8];
+	for (unsigned i = 0; i < 8; ++i)
+		fds[i] = connect_client();
+
+	for (unsigned i = 0; i < 8; ++i)
+		write_string(fds[i], "ping\nwhoami\n");
+
+	for (unsigned i = 0; i < 8; ++i) {
+		expect_line(fds[i], "OK");
+		ck_assert_int_gt(whoami(fds[i]), 0);
+		close(fds[i]);
+	}
+}
+END_TEST
+
+START_TEST(test_command_list)
+{
+	const int fd = connect_client();
+	write_string(fd, "command_list_ok_begin\nping\n");
+	write_string(fd, "ping\ncommand_list_end\nping\n");
+	expect_line(fd, "list_OK");
+	expect_line(fd, "list_OK");
+	expect_line(fd, "OK");
+	expect_line(fd, "OK");
+	close(fd);
+}
+END_TEST
+
+START_TEST(test_setup_list)
+{
+	int fd = connect_single_client();
+	const int pid = whoami(fd);
+	close(fd);
+
+	/* this is what mpc sends with "--password"; it is forwarded
+	   over the shared connection */
+	fd = connect_single_client();
+	write_string(fd, "command_list_ok_begin\npassword \"secret\"\n"
+		     "whoami\ncommand_list_end\n");
+	expect_line(fd, "list_OK");
+
+	char line[64];
+	snprintf(line, sizeof(line), "pid: %d", pid);
+	expect_line(fd, line);
+	expect_line(fd, "list_OK");
+	expect_line(fd, "OK");
+	close(fd);
+}
+END_TEST
+
+START_TEST(test_tagtypes)
+{
+	const int fd = connect_single_client(), other_fd = connect_single_client();
+
+	write_string(fd, "tagtypes clear\ntagtypes enable Artist\n"
+		     "tagtypes\n");
+	expect_line(fd, "OK");
+	expect_line(fd, "OK");
+	expect_line(fd, "tagtype: Artist");
+	expect_line(fd, "OK");
+
+	/* the shared connection is restored for other clients */
+	write_string(other_fd, "tagtypes\n");
+	expect_line(other_fd, "tagtype: all");
+	expect_line(other_fd, "OK");
+
+	write_string(fd, "tagtypes\n");
+	expect_line(fd, "tagtype: Artist");
+	expect_line(fd, "OK");
+
+	/* "tagtypes" does not need a dedicated connection */
+	ck_assert_int_eq(whoami(fd), whoami(other_fd));
+
+	close(other_fd);
+	close(fd);
+}
+END_TEST
+
+START_TEST(test_binary)
+{
+	const int fd = connect_client();
+	write_string(fd, "binary\nping\n");
+
+	/* the payload contains "OK" lines which must not end the
+	   response */
+	char buffer[sizeof(binary_response) - 1 + 3];
+	size_t length = 0;
+	while (length < sizeof(buffer)) {
+		const ssize_t n = read(fd, buffer + length,
+				       sizeof(buffer) - length);
+		ck_assert_int_gt(n, 0);
+		length += n;
+	}
+
+	ck_assert(memcmp(buffer, binary_response,
+			 sizeof(binary_response) - 1) == 0);
+	ck_assert(memcmp(buffer + sizeof(binary_response) - 1,
+			 "OK\n", 3) == 0);
+	close(fd);
+}
+END_TEST
+
+START_TEST(test_idle)
+{
+	const int idle_fd = connect_single_client();
+	write_string(idle_fd, "idle\n");
+
+	/* other clients are not blocked by the idle client */
+	const int fd = connect_single_client();
+	const int pid = whoami(fd);
+
+	write_string(idle_fd, "noidle\n");
+	expect_line(idle_fd, "OK");
+
+	/* the idle client got a dedicated connection */
+	ck_assert_int_ne(whoami(idle_fd), pid);
+	ck_assert_int_eq(whoami(fd), pid);
+
+	close(idle_fd);
+	close(fd);
+}
+END_TEST
+
+static Suite *
+create_suite(void)
+{
+	Suite *s = suite_create("proxy");
+	TCase *tc_core = tcase_create("Core");
+	tcase_add_test(tc_core, test_simple);
+	tcase_add_test(tc_core, test_shared);
+	tcase_add_test(tc_core, test_pipelined);
+	tcase_add_test(tc_core, test_command_list);
+	tcase_add_test(tc_core, test_setup_list);
+	tcase_add_test(tc_core, test_tagtypes);
+	tcase_add_test(tc_core, test_binary);
+	tcase_add_test(tc_core, test_idle);
+	suite_add_tcase(s, tc_core);
+	return s;
+}
+
+int
+main(void)
+{
+	if (mkdtemp(directory) == NULL) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+
+	snprintf(mpd_path, sizeof(mpd_path), "%s/mpd", directory);
+	snprintf(proxy_path, sizeof(proxy_path), "%s/proxy", directory);
+	snprintf(single_proxy_path, sizeof(single_proxy_path),
+		 "%s/single_proxy", directory);
+
+	const pid_t mpd_pid = start_fake_mpd(mpd_path);
+	const pid_t proxy_pid = start_proxy(proxy_path, 2);
+	const pid_t single_proxy_pid = start_proxy(single_proxy_path, 1);
+
+	Suite *s = create_suite();
+	SRunner *sr = srunner_create(s);
+	srunner_run_all(sr, CK_NORMAL);
+	int number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	kill(single_proxy_pid, SIGTERM);
+	waitpid(single_proxy_pid, NULL, 0);
+	kill(proxy_pid, SIGTERM);
+	waitpid(proxy_pid, NULL, 0);
+	kill(mpd_pid, SIGTERM);
+	waitpid(mpd_pid, NULL, 0);
+
+	unlink(single_proxy_path);
+	unlink(proxy_path);
+	unlink(mpd_path);
+	rmdir(directory);
+
+	return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}